@@ -0,0 +1,240 @@
+/*************************************************************************/
+/*  batch.cpp                                                            */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "batch.h"
+
+#include "core/config/project_settings.h"
+#include "core/io/dir_access.h"
+#include "core/io/resource_loader.h"
+#include "core/io/resource_saver.h"
+#include "core/os/os.h"
+#include "core/os/thread.h"
+#include "core/templates/hash_set.h"
+#include "scene/resources/packed_scene.h"
+
+#include "merge.h"
+
+bool SceneMergeBatch::_is_scene_file(const String &p_path) {
+	const String extension = p_path.get_extension().to_lower();
+	return extension == "tscn" || extension == "scn";
+}
+
+void SceneMergeBatch::_find_scenes(const String &p_dir, const String &p_pattern, bool p_recursive, PackedStringArray &r_files) const {
+	Ref<DirAccess> dir = DirAccess::open(p_dir);
+	ERR_FAIL_COND_MSG(dir.is_null(), "Can't open directory " + p_dir + ".");
+	dir->list_dir_begin();
+	for (String file = dir->get_next(); !file.is_empty(); file = dir->get_next()) {
+		if (file == "." || file == "..") {
+			continue;
+		}
+		const String path = p_dir.path_join(file);
+		if (dir->current_is_dir()) {
+			if (p_recursive) {
+				_find_scenes(path, p_pattern, p_recursive, r_files);
+			}
+			continue;
+		}
+		if (_is_scene_file(file) && file.match(p_pattern)) {
+			r_files.push_back(path);
+		}
+	}
+	dir->list_dir_end();
+}
+
+PackedStringArray SceneMergeBatch::expand_inputs(const PackedStringArray &p_inputs) const {
+	PackedStringArray files;
+	for (int32_t input_i = 0; input_i < p_inputs.size(); input_i++) {
+		const String input = p_inputs[input_i];
+		const String file = input.get_file();
+		if (DirAccess::dir_exists_absolute(input)) {
+			_find_scenes(input, "*", true, files);
+		} else if (file.find("*") != -1 || file.find("?") != -1) {
+			_find_scenes(input.get_base_dir(), file, false, files);
+		} else {
+			files.push_back(input);
+		}
+	}
+	files.sort();
+	PackedStringArray unique_files;
+	for (int32_t file_i = 0; file_i < files.size(); file_i++) {
+		if (file_i == 0 || files[file_i] != files[file_i - 1]) {
+			unique_files.push_back(files[file_i]);
+		}
+	}
+	return unique_files;
+}
+
+String SceneMergeBatch::_get_output_path(const String &p_input) const {
+	if (output_dir.is_empty()) {
+		return p_input.get_basename() + "_merged.scn";
+	}
+	return output_dir.path_join(p_input.get_file().get_basename() + ".scn");
+}
+
+Error SceneMergeBatch::_merge_scene(const String &p_input, const String &p_output) {
+	Ref<PackedScene> source = ResourceLoader::load(p_input, "PackedScene");
+	ERR_FAIL_COND_V_MSG(source.is_null(), ERR_CANT_OPEN, "Can't load scene for merging: " + p_input + ".");
+	// The original is never added to a SceneTree; merging composes its global transforms through the parent chain.
+	Node *original = source->instantiate();
+	ERR_FAIL_NULL_V_MSG(original, ERR_CANT_CREATE, "Can't instantiate scene for merging: " + p_input + ".");
+	Node *root = source->instantiate();
+	Ref<MeshMergeMaterialRepack> repack;
+	repack.instantiate();
+	root = repack->merge(root, original, p_output);
+	// A merge that failed part way leaves a partly merged scene, which is not saved.
+	Error err = repack->get_merge_error();
+	Ref<PackedScene> scene;
+	scene.instantiate();
+	if (err == OK) {
+		err = scene->pack(root);
+	}
+	if (err == OK) {
+		err = ResourceSaver::save(scene, p_output);
+	}
+	memdelete(root);
+	memdelete(original);
+	return err;
+}
+
+void SceneMergeBatch::_thread_func(void *p_userdata) {
+	SceneMergeBatch *batch = static_cast<SceneMergeBatch *>(p_userdata);
+	while (true) {
+		const uint32_t job_i = batch->next_job.postincrement();
+		if (job_i >= batch->jobs.size()) {
+			break;
+		}
+		Job &job = batch->jobs[job_i];
+		job.error = _merge_scene(job.input, job.output);
+	}
+}
+
+SceneMergeBatch::ExitCode SceneMergeBatch::run(const PackedStringArray &p_inputs) {
+	const PackedStringArray files = expand_inputs(p_inputs);
+	if (files.is_empty()) {
+		ERR_PRINT("No .tscn or .scn scenes to merge.");
+		return EXIT_USAGE;
+	}
+	jobs.clear();
+	HashSet<String> outputs;
+	for (int32_t file_i = 0; file_i < files.size(); file_i++) {
+		Job job;
+		job.input = files[file_i];
+		job.output = _get_output_path(job.input);
+		if (outputs.has(job.output)) {
+			ERR_PRINT("More than one scene would be merged into " + job.output + ".");
+			return EXIT_USAGE;
+		}
+		outputs.insert(job.output);
+		jobs.push_back(job);
+	}
+	if (!output_dir.is_empty()) {
+		DirAccess::make_dir_recursive_absolute(ProjectSettings::get_singleton()->globalize_path(output_dir));
+	}
+
+	const int32_t thread_count = CLAMP(job_count > 0 ? job_count : OS::get_singleton()->get_processor_count(), 1, (int32_t)jobs.size());
+	next_job.set(0);
+	Thread *threads = memnew_arr(Thread, thread_count);
+	for (int32_t thread_i = 0; thread_i < thread_count; thread_i++) {
+		threads[thread_i].start(_thread_func, this);
+	}
+	for (int32_t thread_i = 0; thread_i < thread_count; thread_i++) {
+		threads[thread_i].wait_to_finish();
+	}
+	memdelete_arr(threads);
+
+	int32_t failed_count = 0;
+	for (const Job &job : jobs) {
+		if (job.error == OK) {
+			print_line("Merged " + job.input + " into " + job.output + ".");
+		} else {
+			ERR_PRINT("Failed to merge " + job.input + ": " + error_names[job.error] + ".");
+			failed_count++;
+		}
+	}
+	print_line(vformat("Merged %d of %d scenes.", jobs.size() - failed_count, jobs.size()));
+	return failed_count ? EXIT_FAILED : EXIT_OK;
+}
+
+SceneMergeBatch::ExitCode SceneMergeBatch::run_from_command_line() {
+	// Arguments after "--" on the Godot command line: [--jobs N] [--output DIR] <scene or glob>...
+	const List<String> args = OS::get_singleton()->get_cmdline_user_args();
+	PackedStringArray inputs;
+	for (const List<String>::Element *E = args.front(); E; E = E->next()) {
+		const String arg = E->get();
+		if (arg == "--jobs" || arg == "-j") {
+			ERR_FAIL_COND_V_MSG(!E->next() || !E->next()->get().is_valid_int(), EXIT_USAGE, "--jobs needs a job count.");
+			E = E->next();
+			set_job_count(E->get().to_int());
+		} else if (arg == "--output" || arg == "-o") {
+			ERR_FAIL_COND_V_MSG(!E->next(), EXIT_USAGE, "--output needs a directory.");
+			E = E->next();
+			set_output_dir(E->get());
+		} else if (arg == "--help" || arg == "-h") {
+			print_line("Usage: -- [--jobs N] [--output DIR] <scene, directory or glob>...");
+			return EXIT_OK;
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	return run(inputs);
+}
+
+void SceneMergeBatch::set_job_count(int32_t p_count) {
+	job_count = MAX(p_count, 0);
+}
+
+int32_t SceneMergeBatch::get_job_count() const {
+	return job_count;
+}
+
+void SceneMergeBatch::set_output_dir(const String &p_dir) {
+	output_dir = p_dir;
+}
+
+String SceneMergeBatch::get_output_dir() const {
+	return output_dir;
+}
+
+void SceneMergeBatch::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("expand_inputs", "inputs"), &SceneMergeBatch::expand_inputs);
+	ClassDB::bind_method(D_METHOD("run", "inputs"), &SceneMergeBatch::run);
+	ClassDB::bind_method(D_METHOD("run_from_command_line"), &SceneMergeBatch::run_from_command_line);
+	ClassDB::bind_method(D_METHOD("set_job_count", "count"), &SceneMergeBatch::set_job_count);
+	ClassDB::bind_method(D_METHOD("get_job_count"), &SceneMergeBatch::get_job_count);
+	ClassDB::bind_method(D_METHOD("set_output_dir", "dir"), &SceneMergeBatch::set_output_dir);
+	ClassDB::bind_method(D_METHOD("get_output_dir"), &SceneMergeBatch::get_output_dir);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "job_count", PROPERTY_HINT_RANGE, "0,256,1,or_greater"), "set_job_count", "get_job_count");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "output_dir", PROPERTY_HINT_DIR), "set_output_dir", "get_output_dir");
+
+	BIND_ENUM_CONSTANT(EXIT_OK);
+	BIND_ENUM_CONSTANT(EXIT_FAILED);
+	BIND_ENUM_CONSTANT(EXIT_USAGE);
+}
@@ -0,0 +1,84 @@
+/*************************************************************************/
+/*  batch.h                                                              */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef SCENE_MERGE_BATCH_H
+#define SCENE_MERGE_BATCH_H
+
+#include "core/object/ref_counted.h"
+#include "core/templates/local_vector.h"
+#include "core/templates/safe_refcount.h"
+
+// Merges many scene files without the editor, for content build pipelines.
+// Every scene is loaded, merged and saved off the main thread, several scenes at a time.
+class SceneMergeBatch : public RefCounted {
+	GDCLASS(SceneMergeBatch, RefCounted);
+
+public:
+	enum ExitCode {
+		EXIT_OK = 0,
+		EXIT_FAILED = 1, // At least one scene could not be merged.
+		EXIT_USAGE = 2, // Bad arguments, or nothing to merge.
+	};
+
+private:
+	struct Job {
+		String input;
+		String output;
+		Error error = OK;
+	};
+
+	int32_t job_count = 0; // 0 runs one job per processor.
+	String output_dir; // Empty writes each result next to its source as <name>_merged.scn.
+	LocalVector<Job> jobs;
+	SafeNumeric<uint32_t> next_job;
+
+	static void _thread_func(void *p_userdata);
+	static Error _merge_scene(const String &p_input, const String &p_output);
+	static bool _is_scene_file(const String &p_path);
+	void _find_scenes(const String &p_dir, const String &p_pattern, bool p_recursive, PackedStringArray &r_files) const;
+	String _get_output_path(const String &p_input) const;
+
+protected:
+	static void _bind_methods();
+
+public:
+	PackedStringArray expand_inputs(const PackedStringArray &p_inputs) const;
+	ExitCode run(const PackedStringArray &p_inputs);
+	ExitCode run_from_command_line();
+
+	void set_job_count(int32_t p_count);
+	int32_t get_job_count() const;
+	void set_output_dir(const String &p_dir);
+	String get_output_dir() const;
+};
+
+VARIANT_ENUM_CAST(SceneMergeBatch::ExitCode);
+
+#endif
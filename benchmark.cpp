@@ -0,0 +1,425 @@
+/*************************************************************************/
+/*  benchmark.cpp                                                        */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#include "benchmark.h"
+
+#include "core/config/project_settings.h"
+#include "core/io/dir_access.h"
+#include "core/io/file_access.h"
+#include "core/io/image.h"
+#include "core/io/json.h"
+#include "core/os/os.h"
+#include "scene/3d/mesh_instance_3d.h"
+#include "scene/main/scene_tree.h"
+#include "scene/main/window.h"
+#include "scene/resources/packed_scene.h"
+
+#include "merge.h"
+
+// Stages faster than this in the baseline are too noisy to flag as regressions.
+static const double benchmark_min_compared_usec = 1000.0;
+
+// Configs read back from JSON hold every number as a float, so values are compared by value rather than by type.
+static bool _configs_match(const Dictionary &p_a, const Dictionary &p_b) {
+	if (p_a.size() != p_b.size()) {
+		return false;
+	}
+	const Array keys = p_a.keys();
+	for (int32_t key_i = 0; key_i < keys.size(); key_i++) {
+		if (!p_b.has(keys[key_i])) {
+			return false;
+		}
+		Variant equal;
+		bool valid = false;
+		Variant::evaluate(Variant::OP_EQUAL, p_a[keys[key_i]], p_b[keys[key_i]], equal, valid);
+		if (!valid || !bool(equal)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Ref<BaseMaterial3D> SceneMergeBenchmark::_generate_material(RandomPCG &p_rng, int32_t p_index) const {
+	Ref<StandardMaterial3D> material;
+	material.instantiate();
+	material->set_name(vformat("Material%d", p_index));
+	const Color tint = Color(p_rng.randf(), p_rng.randf(), p_rng.randf());
+	// Checkerboard with per-texel noise, so the atlas and dilation work on non-uniform data.
+	Ref<Image> image = Image::create_empty(texture_size, texture_size, false, Image::FORMAT_RGBA8);
+	uint8_t *image_w = image->ptrw();
+	const int32_t checker_size = MAX(texture_size / 8, 1);
+	for (int32_t y = 0; y < texture_size; y++) {
+		for (int32_t x = 0; x < texture_size; x++) {
+			const float shade = ((x / checker_size + y / checker_size) & 1) ? 1.0f : 0.5f;
+			const int32_t noise = int32_t(p_rng.rand() & 0x1f) - 16;
+			uint8_t *texel = image_w + (y * texture_size + x) * 4;
+			texel[0] = (uint8_t)CLAMP(int32_t(tint.r * shade * 255.0f) + noise, 0, 255);
+			texel[1] = (uint8_t)CLAMP(int32_t(tint.g * shade * 255.0f) + noise, 0, 255);
+			texel[2] = (uint8_t)CLAMP(int32_t(tint.b * shade * 255.0f) + noise, 0, 255);
+			texel[3] = 255;
+		}
+	}
+	material->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, ImageTexture::create_from_image(image));
+	material->set_roughness(p_rng.randf());
+	material->set_metallic(p_rng.randf());
+	return material;
+}
+
+Ref<Mesh> SceneMergeBenchmark::_generate_mesh(RandomPCG &p_rng, const Ref<Material> &p_material) const {
+	// A subdivided, slightly displaced plane with cells * cells * 2 triangles.
+	const int32_t cells = MAX(1, (int32_t)Math::ceil(Math::sqrt(triangles_per_mesh * 0.5)));
+	const int32_t row = cells + 1;
+	const float size = p_rng.random(0.5f, 4.0f);
+	PackedVector3Array positions;
+	PackedVector3Array normals;
+	PackedVector2Array uvs;
+	PackedInt32Array indices;
+	positions.resize(row * row);
+	normals.resize(row * row);
+	uvs.resize(row * row);
+	indices.resize(cells * cells * 6);
+	Vector3 *positions_w = positions.ptrw();
+	Vector3 *normals_w = normals.ptrw();
+	Vector2 *uvs_w = uvs.ptrw();
+	int32_t *indices_w = indices.ptrw();
+	for (int32_t y = 0; y < row; y++) {
+		for (int32_t x = 0; x < row; x++) {
+			const float u = float(x) / cells;
+			const float v = float(y) / cells;
+			positions_w[y * row + x] = Vector3((u - 0.5f) * size, p_rng.random(-0.05f, 0.05f) * size, (v - 0.5f) * size);
+			normals_w[y * row + x] = Vector3(0.0f, 1.0f, 0.0f);
+			uvs_w[y * row + x] = Vector2(u, v);
+		}
+	}
+	for (int32_t y = 0; y < cells; y++) {
+		for (int32_t x = 0; x < cells; x++) {
+			const int32_t a = y * row + x;
+			int32_t *quad = indices_w + (y * cells + x) * 6;
+			quad[0] = a;
+			quad[1] = a + 1;
+			quad[2] = a + row;
+			quad[3] = a + 1;
+			quad[4] = a + row + 1;
+			quad[5] = a + row;
+		}
+	}
+	Array arrays;
+	arrays.resize(Mesh::ARRAY_MAX);
+	arrays[Mesh::ARRAY_VERTEX] = positions;
+	arrays[Mesh::ARRAY_NORMAL] = normals;
+	arrays[Mesh::ARRAY_TEX_UV] = uvs;
+	arrays[Mesh::ARRAY_INDEX] = indices;
+	Ref<ArrayMesh> mesh;
+	mesh.instantiate();
+	mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, arrays);
+	mesh->surface_set_material(0, p_material);
+	return mesh;
+}
+
+uint64_t SceneMergeBenchmark::_get_peak_rss() {
+	// The resident set high-water mark is only exposed by Linux; elsewhere fall back to Godot's own allocator peak.
+	Ref<FileAccess> status = FileAccess::open("/proc/self/status", FileAccess::READ);
+	if (status.is_valid()) {
+		while (!status->eof_reached()) {
+			const String line = status->get_line();
+			if (line.begins_with("VmHWM:")) {
+				return uint64_t(line.get_slice(":", 1).strip_edges().get_slice(" ", 0).to_int()) * 1024;
+			}
+		}
+	}
+	return OS::get_singleton()->get_static_memory_peak_usage();
+}
+
+Node3D *SceneMergeBenchmark::generate_scene() const {
+	RandomPCG rng(seed);
+	Node3D *root = memnew(Node3D);
+	root->set_name("SceneMergeBenchmark");
+	Vector<Ref<Material> > materials;
+	for (int32_t material_i = 0; material_i < MAX(material_count, 1); material_i++) {
+		materials.push_back(_generate_material(rng, material_i));
+	}
+	// Meshes are spread over a chain of nested nodes, so global transforms are composed at every depth.
+	LocalVector<Node3D *> levels;
+	Node3D *parent = root;
+	for (int32_t level_i = 0; level_i < hierarchy_depth; level_i++) {
+		Node3D *level = memnew(Node3D);
+		level->set_name(vformat("Level%d", level_i));
+		level->set_position(Vector3(rng.random(-1.0f, 1.0f), 0.0f, rng.random(-1.0f, 1.0f)));
+		level->set_rotation(Vector3(0.0f, rng.random(-Math_PI, Math_PI), 0.0f));
+		parent->add_child(level, true);
+		level->set_owner(root);
+		levels.push_back(level);
+		parent = level;
+	}
+	for (int32_t mesh_i = 0; mesh_i < mesh_count; mesh_i++) {
+		MeshInstance3D *mesh_instance = memnew(MeshInstance3D);
+		mesh_instance->set_name(vformat("Mesh%d", mesh_i));
+		mesh_instance->set_mesh(_generate_mesh(rng, materials[mesh_i % materials.size()]));
+		mesh_instance->set_position(Vector3(rng.random(-64.0f, 64.0f), rng.random(-8.0f, 8.0f), rng.random(-64.0f, 64.0f)));
+		Node3D *level = levels.is_empty() ? root : levels[mesh_i % levels.size()];
+		level->add_child(mesh_instance, true);
+		mesh_instance->set_owner(root);
+	}
+	return root;
+}
+
+Dictionary SceneMergeBenchmark::run() {
+	SceneTree *tree = SceneTree::get_singleton();
+	ERR_FAIL_NULL_V_MSG(tree, Dictionary(), "The scene merge benchmark needs a running SceneTree, because merging reads global transforms.");
+	ERR_FAIL_COND_V(iterations < 1, Dictionary());
+	DirAccess::make_dir_recursive_absolute(ProjectSettings::get_singleton()->globalize_path(output_path.get_base_dir()));
+
+	HashMap<String, Vector<uint64_t> > stage_usec;
+	HashMap<String, uint64_t> stage_items;
+	Vector<uint64_t> merge_usec;
+	for (int32_t iteration_i = 0; iteration_i < iterations; iteration_i++) {
+		Node3D *original = generate_scene();
+		tree->get_root()->add_child(original);
+		Ref<PackedScene> packed;
+		packed.instantiate();
+		packed->pack(original);
+		Node *copy = packed->instantiate();
+
+		Ref<MeshMergeMaterialRepack> repack;
+		repack.instantiate();
+		// Every iteration merges the same scene to the same path, so cached groups would turn it into a cache load.
+		repack->set_cache_enabled(false);
+		Node *merged = repack->merge(copy, original, output_path);
+		const Dictionary stats = repack->get_merge_stats();
+		tree->get_root()->remove_child(original);
+		memdelete(original);
+		memdelete(merged);
+
+		merge_usec.push_back(stats["usec"]);
+		const Dictionary totals = stats["totals"];
+		const Array names = totals.keys();
+		for (int32_t name_i = 0; name_i < names.size(); name_i++) {
+			const String name = names[name_i];
+			const Dictionary total = totals[name];
+			if (!stage_usec.has(name)) {
+				stage_usec.insert(name, Vector<uint64_t>());
+			}
+			stage_usec[name].push_back(total["usec"]);
+			stage_items[name] = total["items"];
+		}
+	}
+
+	// The fastest run is the least disturbed by the rest of the system, so throughput is derived from it.
+	Dictionary stages;
+	for (KeyValue<String, Vector<uint64_t> > &kv : stage_usec) {
+		kv.value.sort();
+		const uint64_t usec_min = kv.value[0];
+		const uint64_t items = stage_items[kv.key];
+		Dictionary stage;
+		stage["usec_min"] = usec_min;
+		stage["usec_median"] = kv.value[kv.value.size() / 2];
+		stage["items"] = items;
+		stage["items_per_second"] = usec_min ? double(items) * 1000000.0 / double(usec_min) : 0.0;
+		stages[kv.key] = stage;
+	}
+	merge_usec.sort();
+
+	Dictionary config;
+	config["mesh_count"] = mesh_count;
+	config["material_count"] = material_count;
+	config["texture_size"] = texture_size;
+	config["triangles_per_mesh"] = triangles_per_mesh;
+	config["hierarchy_depth"] = hierarchy_depth;
+	config["seed"] = seed;
+
+	Dictionary results;
+	results["config"] = config;
+	results["iterations"] = iterations;
+	results["usec_min"] = merge_usec[0];
+	results["usec_median"] = merge_usec[merge_usec.size() / 2];
+	results["peak_rss"] = _get_peak_rss();
+	results["stages"] = stages;
+	return results;
+}
+
+Dictionary SceneMergeBenchmark::compare_with_baseline(const Dictionary &p_results, const String &p_baseline_path) const {
+	Error err = OK;
+	const String text = FileAccess::get_file_as_string(p_baseline_path, &err);
+	ERR_FAIL_COND_V_MSG(err != OK, Dictionary(), "Cannot read scene merge benchmark baseline " + p_baseline_path + ".");
+	const Dictionary baseline = JSON::parse_string(text);
+	const Dictionary baseline_stages = baseline.get("stages", Dictionary());
+	const Dictionary stages = p_results.get("stages", Dictionary());
+
+	Array regressions;
+	const Array names = stages.keys();
+	for (int32_t name_i = 0; name_i < names.size(); name_i++) {
+		const String name = names[name_i];
+		if (!baseline_stages.has(name)) {
+			continue;
+		}
+		const Dictionary baseline_stage = baseline_stages[name];
+		const Dictionary stage = stages[name];
+		const double baseline_usec = baseline_stage.get("usec_min", 0.0);
+		const double usec = stage.get("usec_min", 0.0);
+		if (baseline_usec < benchmark_min_compared_usec) {
+			continue;
+		}
+		const double ratio = usec / baseline_usec;
+		if (ratio > 1.0 + regression_tolerance) {
+			Dictionary regression;
+			regression["stage"] = name;
+			regression["baseline_usec"] = baseline_usec;
+			regression["usec"] = usec;
+			regression["ratio"] = ratio;
+			regressions.push_back(regression);
+		}
+	}
+	// Timings from a different scene or texture size say nothing about regressions, so such a comparison never passes.
+	const bool config_matches = _configs_match(baseline.get("config", Dictionary()), p_results.get("config", Dictionary()));
+	if (!config_matches) {
+		WARN_PRINT("Scene merge benchmark baseline " + p_baseline_path + " was recorded with a different config.");
+	}
+	Dictionary comparison;
+	comparison["config_matches"] = config_matches;
+	comparison["regressions"] = regressions;
+	comparison["passed"] = config_matches && regressions.is_empty();
+	return comparison;
+}
+
+Error SceneMergeBenchmark::save_baseline(const Dictionary &p_results, const String &p_baseline_path) const {
+	Error err = OK;
+	Ref<FileAccess> file = FileAccess::open(p_baseline_path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V_MSG(file.is_null(), err, "Cannot write scene merge benchmark baseline " + p_baseline_path + ".");
+	file->store_string(JSON::stringify(p_results, "\t"));
+	return OK;
+}
+
+void SceneMergeBenchmark::set_mesh_count(int32_t p_count) {
+	mesh_count = MAX(p_count, 0);
+}
+
+int32_t SceneMergeBenchmark::get_mesh_count() const {
+	return mesh_count;
+}
+
+void SceneMergeBenchmark::set_material_count(int32_t p_count) {
+	material_count = MAX(p_count, 1);
+}
+
+int32_t SceneMergeBenchmark::get_material_count() const {
+	return material_count;
+}
+
+void SceneMergeBenchmark::set_texture_size(int32_t p_size) {
+	texture_size = CLAMP(p_size, 1, Image::MAX_WIDTH);
+}
+
+int32_t SceneMergeBenchmark::get_texture_size() const {
+	return texture_size;
+}
+
+void SceneMergeBenchmark::set_triangles_per_mesh(int32_t p_count) {
+	triangles_per_mesh = MAX(p_count, 2);
+}
+
+int32_t SceneMergeBenchmark::get_triangles_per_mesh() const {
+	return triangles_per_mesh;
+}
+
+void SceneMergeBenchmark::set_hierarchy_depth(int32_t p_depth) {
+	hierarchy_depth = MAX(p_depth, 0);
+}
+
+int32_t SceneMergeBenchmark::get_hierarchy_depth() const {
+	return hierarchy_depth;
+}
+
+void SceneMergeBenchmark::set_iterations(int32_t p_iterations) {
+	iterations = MAX(p_iterations, 1);
+}
+
+int32_t SceneMergeBenchmark::get_iterations() const {
+	return iterations;
+}
+
+void SceneMergeBenchmark::set_seed(int64_t p_seed) {
+	seed = p_seed;
+}
+
+int64_t SceneMergeBenchmark::get_seed() const {
+	return seed;
+}
+
+void SceneMergeBenchmark::set_regression_tolerance(float p_tolerance) {
+	regression_tolerance = MAX(p_tolerance, 0.0f);
+}
+
+float SceneMergeBenchmark::get_regression_tolerance() const {
+	return regression_tolerance;
+}
+
+void SceneMergeBenchmark::set_output_path(const String &p_path) {
+	output_path = p_path;
+}
+
+String SceneMergeBenchmark::get_output_path() const {
+	return output_path;
+}
+
+void SceneMergeBenchmark::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("generate_scene"), &SceneMergeBenchmark::generate_scene);
+	ClassDB::bind_method(D_METHOD("run"), &SceneMergeBenchmark::run);
+	ClassDB::bind_method(D_METHOD("compare_with_baseline", "results", "baseline_path"), &SceneMergeBenchmark::compare_with_baseline);
+	ClassDB::bind_method(D_METHOD("save_baseline", "results", "baseline_path"), &SceneMergeBenchmark::save_baseline);
+
+	ClassDB::bind_method(D_METHOD("set_mesh_count", "count"), &SceneMergeBenchmark::set_mesh_count);
+	ClassDB::bind_method(D_METHOD("get_mesh_count"), &SceneMergeBenchmark::get_mesh_count);
+	ClassDB::bind_method(D_METHOD("set_material_count", "count"), &SceneMergeBenchmark::set_material_count);
+	ClassDB::bind_method(D_METHOD("get_material_count"), &SceneMergeBenchmark::get_material_count);
+	ClassDB::bind_method(D_METHOD("set_texture_size", "size"), &SceneMergeBenchmark::set_texture_size);
+	ClassDB::bind_method(D_METHOD("get_texture_size"), &SceneMergeBenchmark::get_texture_size);
+	ClassDB::bind_method(D_METHOD("set_triangles_per_mesh", "count"), &SceneMergeBenchmark::set_triangles_per_mesh);
+	ClassDB::bind_method(D_METHOD("get_triangles_per_mesh"), &SceneMergeBenchmark::get_triangles_per_mesh);
+	ClassDB::bind_method(D_METHOD("set_hierarchy_depth", "depth"), &SceneMergeBenchmark::set_hierarchy_depth);
+	ClassDB::bind_method(D_METHOD("get_hierarchy_depth"), &SceneMergeBenchmark::get_hierarchy_depth);
+	ClassDB::bind_method(D_METHOD("set_iterations", "iterations"), &SceneMergeBenchmark::set_iterations);
+	ClassDB::bind_method(D_METHOD("get_iterations"), &SceneMergeBenchmark::get_iterations);
+	ClassDB::bind_method(D_METHOD("set_seed", "seed"), &SceneMergeBenchmark::set_seed);
+	ClassDB::bind_method(D_METHOD("get_seed"), &SceneMergeBenchmark::get_seed);
+	ClassDB::bind_method(D_METHOD("set_regression_tolerance", "tolerance"), &SceneMergeBenchmark::set_regression_tolerance);
+	ClassDB::bind_method(D_METHOD("get_regression_tolerance"), &SceneMergeBenchmark::get_regression_tolerance);
+	ClassDB::bind_method(D_METHOD("set_output_path", "path"), &SceneMergeBenchmark::set_output_path);
+	ClassDB::bind_method(D_METHOD("get_output_path"), &SceneMergeBenchmark::get_output_path);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "mesh_count", PROPERTY_HINT_RANGE, "0,65536,1,or_greater"), "set_mesh_count", "get_mesh_count");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "material_count", PROPERTY_HINT_RANGE, "1,1024,1,or_greater"), "set_material_count", "get_material_count");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "texture_size", PROPERTY_HINT_RANGE, "1,8192,1"), "set_texture_size", "get_texture_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "triangles_per_mesh", PROPERTY_HINT_RANGE, "2,1048576,1,or_greater"), "set_triangles_per_mesh", "get_triangles_per_mesh");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "hierarchy_depth", PROPERTY_HINT_RANGE, "0,64,1,or_greater"), "set_hierarchy_depth", "get_hierarchy_depth");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "iterations", PROPERTY_HINT_RANGE, "1,100,1,or_greater"), "set_iterations", "get_iterations");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "regression_tolerance", PROPERTY_HINT_RANGE, "0,10,0.01"), "set_regression_tolerance", "get_regression_tolerance");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "output_path", PROPERTY_HINT_SAVE_FILE, "*.scn"), "set_output_path", "get_output_path");
+}
@@ -0,0 +1,87 @@
+/*************************************************************************/
+/*  benchmark.h                                                          */
+/*************************************************************************/
+/*                       This file is part of:                           */
+/*                           GODOT ENGINE                                */
+/*                      https://godotengine.org                          */
+/*************************************************************************/
+/* Copyright (c) 2007-2019 Juan Linietsky, Ariel Manzur.                 */
+/* Copyright (c) 2014-2019 Godot Engine contributors (cf. AUTHORS.md)    */
+/*                                                                       */
+/* Permission is hereby granted, free of charge, to any person obtaining */
+/* a copy of this software and associated documentation files (the       */
+/* "Software"), to deal in the Software without restriction, including   */
+/* without limitation the rights to use, copy, modify, merge, publish,   */
+/* distribute, sublicense, and/or sell copies of the Software, and to    */
+/* permit persons to whom the Software is furnished to do so, subject to */
+/* the following conditions:                                             */
+/*                                                                       */
+/* The above copyright notice and this permission notice shall be        */
+/* included in all copies or substantial portions of the Software.       */
+/*                                                                       */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,       */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF    */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.*/
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY  */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,  */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE     */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                */
+/*************************************************************************/
+
+#ifndef SCENE_MERGE_BENCHMARK_H
+#define SCENE_MERGE_BENCHMARK_H
+
+#include "core/math/random_pcg.h"
+#include "core/object/ref_counted.h"
+#include "scene/3d/node_3d.h"
+#include "scene/resources/material.h"
+
+// Runs MeshMergeMaterialRepack::merge on procedurally generated scenes and reports per-stage throughput.
+// The same seed and settings always produce the same scene, so results can be compared against a stored baseline.
+class SceneMergeBenchmark : public RefCounted {
+	GDCLASS(SceneMergeBenchmark, RefCounted);
+
+	int32_t mesh_count = 64;
+	int32_t material_count = 8;
+	int32_t texture_size = 512;
+	int32_t triangles_per_mesh = 512;
+	int32_t hierarchy_depth = 4;
+	int32_t iterations = 3;
+	uint64_t seed = 0;
+	float regression_tolerance = 0.1f;
+	String output_path = "user://scene_merge_benchmark/benchmark.scn";
+
+	Ref<BaseMaterial3D> _generate_material(RandomPCG &p_rng, int32_t p_index) const;
+	Ref<Mesh> _generate_mesh(RandomPCG &p_rng, const Ref<Material> &p_material) const;
+	static uint64_t _get_peak_rss();
+
+protected:
+	static void _bind_methods();
+
+public:
+	Node3D *generate_scene() const;
+	Dictionary run();
+	Dictionary compare_with_baseline(const Dictionary &p_results, const String &p_baseline_path) const;
+	Error save_baseline(const Dictionary &p_results, const String &p_baseline_path) const;
+
+	void set_mesh_count(int32_t p_count);
+	int32_t get_mesh_count() const;
+	void set_material_count(int32_t p_count);
+	int32_t get_material_count() const;
+	void set_texture_size(int32_t p_size);
+	int32_t get_texture_size() const;
+	void set_triangles_per_mesh(int32_t p_count);
+	int32_t get_triangles_per_mesh() const;
+	void set_hierarchy_depth(int32_t p_depth);
+	int32_t get_hierarchy_depth() const;
+	void set_iterations(int32_t p_iterations);
+	int32_t get_iterations() const;
+	void set_seed(int64_t p_seed);
+	int64_t get_seed() const;
+	void set_regression_tolerance(float p_tolerance);
+	float get_regression_tolerance() const;
+	void set_output_path(const String &p_path);
+	String get_output_path() const;
+};
+
+#endif
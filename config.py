@@ -1,4 +1,5 @@
 def can_build(env, platform):
+    env.module_add_dependencies("scene_merge", ["meshoptimizer"])
     return True
 
 def configure(env):
@@ -44,28 +44,86 @@ Copyright (c) 2013 Thekla, Inc
 Copyright NVIDIA Corporation 2006 -- Ignacio Castano <icastano@nvidia.com>
 */
 
+#include "core/config/project_settings.h"
 #include "core/core_bind.h"
+#include "core/crypto/crypto_core.h"
+#include "core/io/dir_access.h"
+#include "core/io/file_access.h"
 #include "core/io/image.h"
+#include "core/io/json.h"
+#include "core/io/marshalls.h"
 #include "core/math/vector2.h"
 #include "core/math/vector3.h"
+#include "core/object/worker_thread_pool.h"
 #include "core/os/os.h"
+#include "core/os/thread.h"
+#include "core/templates/sort_array.h"
+#include "core/variant/variant_internal.h"
 #include "editor/editor_file_dialog.h"
 #include "editor/editor_file_system.h"
 #include "scene/3d/node_3d.h"
 #include "scene/animation/animation_player.h"
+#include "scene/resources/animation_library.h"
 #include "scene/resources/mesh_data_tool.h"
 #include "scene/resources/packed_scene.h"
 #include "scene/resources/surface_tool.h"
 
+#include "meshoptimizer.h"
+#include "thirdparty/misc/mikktspace.h"
 #include "thirdparty/misc/rjm_texbleed.h"
 #include "thirdparty/xatlas/xatlas.h"
 #include <time.h>
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCENE_MERGE_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_MERGE_SIMD_SSE2
+#endif
+
 #include "merge.h"
 
+#ifdef TOOLS_ENABLED
+// Merges started outside the editor or off the main thread, such as batch merges, can't report EditorProgress.
+static bool can_show_editor_progress() {
+	return EditorNode::get_singleton() && Thread::is_main_thread();
+}
+#endif
+
+// Stages split their work into group tasks only when called from outside the WorkerThreadPool. A pool task that
+// waits on tasks of its own holds its thread while they queue, and with every thread doing so nothing is left to run
+// them, so stages called from a pool task run their work inline instead.
+static bool is_pool_thread() {
+	return WorkerThreadPool::get_thread_index() != -1;
+}
+
+// Global transform composed through the parent chain, so scenes that were never added to a SceneTree can be merged.
+static Transform3D get_scene_global_transform(const Node3D *p_node) {
+	if (p_node->is_inside_tree()) {
+		return p_node->get_global_transform();
+	}
+	Transform3D xform = p_node->get_transform();
+	if (p_node->is_set_as_top_level()) {
+		return xform;
+	}
+	for (const Node *parent = p_node->get_parent(); parent; parent = parent->get_parent()) {
+		const Node3D *parent_3d = Object::cast_to<Node3D>(parent);
+		if (!parent_3d) {
+			continue;
+		}
+		xform = parent_3d->get_transform() * xform;
+		if (parent_3d->is_set_as_top_level()) {
+			break;
+		}
+	}
+	return xform;
+}
+
 void SceneMerge::merge(const String p_file, Node *p_root_node) {
 	PackedScene *scene = memnew(PackedScene);
 	scene->pack(p_root_node);
@@ -78,40 +136,7 @@ void SceneMerge::merge(const String p_file, Node *p_root_node) {
 	ResourceSaver::save(scene, p_file);
 }
 
-bool MeshMergeMaterialRepack::setAtlasTexel(void *param, int x, int y, const Vector3 &bar, const Vector3 &, const Vector3 &, float) {
-	SetAtlasTexelArgs *args = (SetAtlasTexelArgs *)param;
-	if (args->sourceTexture.is_valid()) {
-		// Interpolate source UVs using barycentrics.
-		const Vector2 sourceUv = args->source_uvs[0] * bar.x + args->source_uvs[1] * bar.y + args->source_uvs[2] * bar.z;
-		// Keep coordinates in range of texture dimensions.
-		int _width = args->sourceTexture->get_width() - 1;
-		float sx = sourceUv.x * _width;
-		while (sx < 0) {
-			sx += _width;
-		}
-		if ((int32_t)sx > _width) {
-			sx = Math::fmod(sx, _width);
-		}
-		int _height = args->sourceTexture->get_height() - 1;
-		float sy = sourceUv.y * _height;
-		while (sy < 0) {
-			sy += _height;
-		}
-		if ((int32_t)sy > _height) {
-			sy = Math::fmod(sy, _height);
-		}
-		const Color color = args->sourceTexture->get_pixel(sx, sy);
-		args->atlasData->set_pixel(x, y, color);
-		AtlasLookupTexel &lookup = args->atlas_lookup[x * y + args->atlas_width];
-		lookup.material_index = args->material_index;
-		lookup.x = (uint16_t)sx;
-		lookup.y = (uint16_t)sy;
-		return true;
-	}
-	return false;
-}
-
-void MeshMergeMaterialRepack::_find_all_mesh_instances(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner) {
+void MeshMergeMaterialRepack::_find_all_mesh_instances(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner, LocalVector<SurfaceSnapshot> *r_surfaces) {
 	MeshInstance3D *mi = cast_to<MeshInstance3D>(p_current_node);
 	bool is_valid = false;
 	if (mi) {
@@ -142,11 +167,6 @@ void MeshMergeMaterialRepack::_find_all_mesh_instances(Vector<MeshMerge> &r_item
 			if (has_blends || has_bones || has_transparency) {
 				break;
 			}
-			if (r_items[r_items.size() - 1].vertex_count > 65536) {
-				MeshMerge new_mesh;
-				r_items.push_back(new_mesh);
-				continue;
-			}
 			Ref<SurfaceTool> st;
 			st.instantiate();
 			st->create_from_triangle_arrays(array);
@@ -157,16 +177,172 @@ void MeshMergeMaterialRepack::_find_all_mesh_instances(Vector<MeshMerge> &r_item
 				mesh_state.path = mi->get_path();
 			}
 			mesh_state.mesh_instance = mi;
+			if (r_surfaces) {
+				mesh_state.surface_id = r_surfaces->size();
+				r_surfaces->resize(r_surfaces->size() + 1);
+				_snapshot_surface(array, (*r_surfaces)[mesh_state.surface_id]);
+			}
 			MeshMerge &mesh = r_items.write[r_items.size() - 1];
 			mesh.vertex_count += vertexes.size();
 			mesh.meshes.push_back(mesh_state);
 		}
 	}
 	for (int32_t child_i = 0; child_i < p_current_node->get_child_count(); child_i++) {
-		_find_all_mesh_instances(r_items, p_current_node->get_child(child_i), p_owner);
+		_find_all_mesh_instances(r_items, p_current_node->get_child(child_i), p_owner, r_surfaces);
+	}
+}
+
+void MeshMergeMaterialRepack::_snapshot_surface(const Array &p_arrays, SurfaceSnapshot &r_surface) {
+	const PackedVector3Array positions = p_arrays[Mesh::ARRAY_VERTEX];
+	const PackedVector3Array normals = p_arrays[Mesh::ARRAY_NORMAL];
+	const PackedVector2Array uvs = p_arrays[Mesh::ARRAY_TEX_UV];
+	const PackedVector2Array uv2s = p_arrays[Mesh::ARRAY_TEX_UV2];
+	const PackedInt32Array indices = p_arrays[Mesh::ARRAY_INDEX];
+	const int32_t vertex_count = positions.size();
+
+	r_surface.positions.resize(vertex_count);
+	r_surface.normals.resize(vertex_count);
+	r_surface.uvs.resize(vertex_count);
+	if (vertex_count) {
+		memcpy(r_surface.positions.ptr(), positions.ptr(), sizeof(Vector3) * vertex_count);
+		if (normals.size() == vertex_count) {
+			memcpy(r_surface.normals.ptr(), normals.ptr(), sizeof(Vector3) * vertex_count);
+		} else {
+			memset((void *)r_surface.normals.ptr(), 0, sizeof(Vector3) * vertex_count);
+		}
+		if (uvs.size() == vertex_count) {
+			memcpy(r_surface.uvs.ptr(), uvs.ptr(), sizeof(Vector2) * vertex_count);
+		} else {
+			memset((void *)r_surface.uvs.ptr(), 0, sizeof(Vector2) * vertex_count);
+		}
+		if (uv2s.size() == vertex_count) {
+			r_surface.uv2s.resize(vertex_count);
+			memcpy(r_surface.uv2s.ptr(), uv2s.ptr(), sizeof(Vector2) * vertex_count);
+		}
+	}
+
+	// Non-indexed surfaces get a sequential index list so every stage can walk faces the same way.
+	if (indices.size()) {
+		r_surface.indices.resize(indices.size());
+		const int32_t *index_r = indices.ptr();
+		for (int32_t index_i = 0; index_i < indices.size(); index_i++) {
+			r_surface.indices[index_i] = index_r[index_i];
+		}
+	} else {
+		r_surface.indices.resize(vertex_count - vertex_count % 3);
+		for (uint32_t index_i = 0; index_i < r_surface.indices.size(); index_i++) {
+			r_surface.indices[index_i] = index_i;
+		}
+	}
+}
+
+void MeshMergeMaterialRepack::_cluster_mesh_items(Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items, const LocalVector<SurfaceSnapshot> &p_surfaces, const ClusterBudget &p_budget) {
+	// Both scans list the same surfaces in the same order, which is what lets their groups be paired up.
+	LocalVector<ClusterItem> cluster;
+	for (int32_t items_i = 0; items_i < r_items.size(); items_i++) {
+		const Vector<MeshState> &meshes = r_items[items_i].meshes;
+		ERR_FAIL_COND(r_original_items && (items_i >= r_original_items->size() || (*r_original_items)[items_i].meshes.size() != meshes.size()));
+		for (int32_t mesh_i = 0; mesh_i < meshes.size(); mesh_i++) {
+			ClusterItem item;
+			item.item = meshes[mesh_i];
+			item.original_item = r_original_items ? (*r_original_items)[items_i].meshes[mesh_i] : meshes[mesh_i];
+			const SurfaceSnapshot &surface = p_surfaces[item.item.surface_id];
+			const Transform3D xform = get_scene_global_transform(item.original_item.mesh_instance);
+			for (uint32_t vertex_i = 0; vertex_i < surface.positions.size(); vertex_i++) {
+				const Vector3 position = xform.xform(surface.positions[vertex_i]);
+				if (vertex_i == 0) {
+					item.bounds = AABB(position, Vector3());
+				} else {
+					item.bounds.expand_to(position);
+				}
+			}
+			item.vertex_count = surface.positions.size();
+			item.triangle_count = surface.indices.size() / 3;
+			item.order = cluster.size();
+			cluster.push_back(item);
+		}
+	}
+	r_items.clear();
+	if (r_original_items) {
+		r_original_items->clear();
+	}
+	if (!cluster.is_empty()) {
+		_split_cluster(cluster, 0, cluster.size(), p_budget, r_items, r_original_items);
+	}
+}
+
+void MeshMergeMaterialRepack::_split_cluster(LocalVector<ClusterItem> &r_cluster, uint32_t p_begin, uint32_t p_end, const ClusterBudget &p_budget, Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items) {
+	uint64_t vertex_count = 0;
+	uint64_t triangle_count = 0;
+	AABB bounds = r_cluster[p_begin].bounds;
+	AABB centers(r_cluster[p_begin].bounds.get_center(), Vector3());
+	for (uint32_t item_i = p_begin; item_i < p_end; item_i++) {
+		vertex_count += r_cluster[item_i].vertex_count;
+		triangle_count += r_cluster[item_i].triangle_count;
+		bounds.merge_with(r_cluster[item_i].bounds);
+		centers.expand_to(r_cluster[item_i].bounds.get_center());
+	}
+	const bool over_vertices = p_budget.max_vertices > 0 && vertex_count > (uint64_t)p_budget.max_vertices;
+	const bool over_triangles = p_budget.max_triangles > 0 && triangle_count > (uint64_t)p_budget.max_triangles;
+	const bool over_extent = p_budget.max_extent > 0.0f && bounds.get_longest_axis_size() > p_budget.max_extent;
+	if (p_end - p_begin == 1 || !(over_vertices || over_triangles || over_extent)) {
+		MeshMerge group;
+		MeshMerge original_group;
+		group.vertex_count = vertex_count;
+		original_group.vertex_count = vertex_count;
+		// Scan order inside a group keeps material and surface order stable between runs.
+		SortArray<ClusterItem, ClusterOrderComparator> sorter;
+		sorter.sort(&r_cluster[p_begin], p_end - p_begin);
+		for (uint32_t item_i = p_begin; item_i < p_end; item_i++) {
+			group.meshes.push_back(r_cluster[item_i].item);
+			original_group.meshes.push_back(r_cluster[item_i].original_item);
+		}
+		r_items.push_back(group);
+		if (r_original_items) {
+			r_original_items->push_back(original_group);
+		}
+		return;
+	}
+	// Split at the median along the longest axis of the surface centers, like one level of a k-d tree. Each half is
+	// spatially compact, so a merged mesh's bounds stay tight enough for frustum and occlusion culling.
+	SortArray<ClusterItem, ClusterAxisComparator> sorter;
+	sorter.compare.axis = centers.get_longest_axis_index();
+	sorter.sort(&r_cluster[p_begin], p_end - p_begin);
+	const uint32_t middle = p_begin + (p_end - p_begin) / 2;
+	_split_cluster(r_cluster, p_begin, middle, p_budget, r_items, r_original_items);
+	_split_cluster(r_cluster, middle, p_end, p_budget, r_items, r_original_items);
+}
+
+void MeshMergeMaterialRepack::_add_hlod_groups(Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items, const LocalVector<SurfaceSnapshot> &p_surfaces, LocalVector<int32_t> &r_levels) {
+	r_levels.clear();
+	for (int32_t items_i = 0; items_i < r_items.size(); items_i++) {
+		r_levels.push_back(0);
+	}
+	// Every proxy level is clustered again from all merged surfaces into cells twice the size of the level below,
+	// so one far proxy stands in for many nearer groups. Proxies have no vertex or triangle budget.
+	const Vector<MeshMerge> items = r_items;
+	const Vector<MeshMerge> original_items = r_original_items ? *r_original_items : Vector<MeshMerge>();
+	for (int32_t level_i = 1; level_i <= hlod_levels; level_i++) {
+		ClusterBudget budget;
+		budget.max_extent = hlod_cell_size * (1 << (level_i - 1));
+		Vector<MeshMerge> cells = items;
+		Vector<MeshMerge> original_cells = original_items;
+		_cluster_mesh_items(cells, r_original_items ? &original_cells : nullptr, p_surfaces, budget);
+		for (int32_t cell_i = 0; cell_i < cells.size(); cell_i++) {
+			r_items.push_back(cells[cell_i]);
+			if (r_original_items) {
+				r_original_items->push_back(original_cells[cell_i]);
+			}
+			r_levels.push_back(level_i);
+		}
 	}
 }
 
+void MeshMergeMaterialRepack::_get_hlod_range(int32_t p_level, float &r_begin, float &r_end) const {
+	r_begin = p_level == 0 ? 0.0f : hlod_distance * (1 << (p_level - 1));
+	r_end = p_level == hlod_levels ? 0.0f : hlod_distance * (1 << p_level);
+}
+
 void MeshMergeMaterialRepack::_find_all_animated_meshes(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner) {
 	AnimationPlayer *ap = cast_to<AnimationPlayer>(p_current_node);
 	if (ap) {
@@ -202,172 +378,1040 @@ void MeshMergeMaterialRepack::_find_all_animated_meshes(Vector<MeshMerge> &r_ite
 
 void MeshMergeMaterialRepack::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("merge", "root", "original_root", "output_path"), &MeshMergeMaterialRepack::merge);
+	ClassDB::bind_method(D_METHOD("rebake", "root", "output_path"), &MeshMergeMaterialRepack::rebake);
+	ClassDB::bind_method(D_METHOD("get_merge_stats"), &MeshMergeMaterialRepack::get_merge_stats);
+	ClassDB::bind_method(D_METHOD("get_merge_error"), &MeshMergeMaterialRepack::get_merge_error);
+	ClassDB::bind_method(D_METHOD("set_trace_path", "path"), &MeshMergeMaterialRepack::set_trace_path);
+	ClassDB::bind_method(D_METHOD("get_trace_path"), &MeshMergeMaterialRepack::get_trace_path);
+	ClassDB::bind_method(D_METHOD("set_cache_enabled", "enabled"), &MeshMergeMaterialRepack::set_cache_enabled);
+	ClassDB::bind_method(D_METHOD("is_cache_enabled"), &MeshMergeMaterialRepack::is_cache_enabled);
+	ClassDB::bind_method(D_METHOD("set_cache_dir", "dir"), &MeshMergeMaterialRepack::set_cache_dir);
+	ClassDB::bind_method(D_METHOD("get_cache_dir"), &MeshMergeMaterialRepack::get_cache_dir);
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "trace_path", PROPERTY_HINT_SAVE_FILE, "*.json"), "set_trace_path", "get_trace_path");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "cache_enabled"), "set_cache_enabled", "is_cache_enabled");
+	ClassDB::bind_method(D_METHOD("set_cluster_max_vertices", "count"), &MeshMergeMaterialRepack::set_cluster_max_vertices);
+	ClassDB::bind_method(D_METHOD("get_cluster_max_vertices"), &MeshMergeMaterialRepack::get_cluster_max_vertices);
+	ClassDB::bind_method(D_METHOD("set_cluster_max_triangles", "count"), &MeshMergeMaterialRepack::set_cluster_max_triangles);
+	ClassDB::bind_method(D_METHOD("get_cluster_max_triangles"), &MeshMergeMaterialRepack::get_cluster_max_triangles);
+	ClassDB::bind_method(D_METHOD("set_cluster_max_extent", "extent"), &MeshMergeMaterialRepack::set_cluster_max_extent);
+	ClassDB::bind_method(D_METHOD("get_cluster_max_extent"), &MeshMergeMaterialRepack::get_cluster_max_extent);
+	ClassDB::bind_method(D_METHOD("set_hlod_levels", "levels"), &MeshMergeMaterialRepack::set_hlod_levels);
+	ClassDB::bind_method(D_METHOD("get_hlod_levels"), &MeshMergeMaterialRepack::get_hlod_levels);
+	ClassDB::bind_method(D_METHOD("set_hlod_distance", "distance"), &MeshMergeMaterialRepack::set_hlod_distance);
+	ClassDB::bind_method(D_METHOD("get_hlod_distance"), &MeshMergeMaterialRepack::get_hlod_distance);
+	ClassDB::bind_method(D_METHOD("set_hlod_cell_size", "size"), &MeshMergeMaterialRepack::set_hlod_cell_size);
+	ClassDB::bind_method(D_METHOD("get_hlod_cell_size"), &MeshMergeMaterialRepack::get_hlod_cell_size);
+	ClassDB::bind_method(D_METHOD("set_hlod_reduction", "reduction"), &MeshMergeMaterialRepack::set_hlod_reduction);
+	ClassDB::bind_method(D_METHOD("get_hlod_reduction"), &MeshMergeMaterialRepack::get_hlod_reduction);
+	ClassDB::bind_method(D_METHOD("set_hlod_max_error", "error"), &MeshMergeMaterialRepack::set_hlod_max_error);
+	ClassDB::bind_method(D_METHOD("get_hlod_max_error"), &MeshMergeMaterialRepack::get_hlod_max_error);
+	ClassDB::bind_method(D_METHOD("set_optimize_vertex_order", "enabled"), &MeshMergeMaterialRepack::set_optimize_vertex_order);
+	ClassDB::bind_method(D_METHOD("is_optimizing_vertex_order"), &MeshMergeMaterialRepack::is_optimizing_vertex_order);
+	ClassDB::bind_method(D_METHOD("set_weld_vertices", "enabled"), &MeshMergeMaterialRepack::set_weld_vertices);
+	ClassDB::bind_method(D_METHOD("is_welding_vertices"), &MeshMergeMaterialRepack::is_welding_vertices);
+	ClassDB::bind_method(D_METHOD("set_lod_count", "count"), &MeshMergeMaterialRepack::set_lod_count);
+	ClassDB::bind_method(D_METHOD("get_lod_count"), &MeshMergeMaterialRepack::get_lod_count);
+	ClassDB::bind_method(D_METHOD("set_lod_reduction", "reduction"), &MeshMergeMaterialRepack::set_lod_reduction);
+	ClassDB::bind_method(D_METHOD("get_lod_reduction"), &MeshMergeMaterialRepack::get_lod_reduction);
+	ClassDB::bind_method(D_METHOD("set_lod_max_error", "error"), &MeshMergeMaterialRepack::set_lod_max_error);
+	ClassDB::bind_method(D_METHOD("get_lod_max_error"), &MeshMergeMaterialRepack::get_lod_max_error);
+	ClassDB::bind_method(D_METHOD("set_thread_budget", "budget"), &MeshMergeMaterialRepack::set_thread_budget);
+	ClassDB::bind_method(D_METHOD("get_thread_budget"), &MeshMergeMaterialRepack::get_thread_budget);
+	ClassDB::bind_method(D_METHOD("set_pack_mode", "mode"), &MeshMergeMaterialRepack::set_pack_mode);
+	ClassDB::bind_method(D_METHOD("get_pack_mode"), &MeshMergeMaterialRepack::get_pack_mode);
+	ClassDB::bind_method(D_METHOD("set_generate_uv2", "enabled"), &MeshMergeMaterialRepack::set_generate_uv2);
+	ClassDB::bind_method(D_METHOD("is_generating_uv2"), &MeshMergeMaterialRepack::is_generating_uv2);
+	ClassDB::bind_method(D_METHOD("set_merge_mode", "mode"), &MeshMergeMaterialRepack::set_merge_mode);
+	ClassDB::bind_method(D_METHOD("get_merge_mode"), &MeshMergeMaterialRepack::get_merge_mode);
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "cache_dir", PROPERTY_HINT_DIR), "set_cache_dir", "get_cache_dir");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cluster_max_vertices", PROPERTY_HINT_RANGE, "0,1048576,1,or_greater"), "set_cluster_max_vertices", "get_cluster_max_vertices");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cluster_max_triangles", PROPERTY_HINT_RANGE, "0,1048576,1,or_greater"), "set_cluster_max_triangles", "get_cluster_max_triangles");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "cluster_max_extent", PROPERTY_HINT_RANGE, "0,10000,0.1,or_greater,suffix:m"), "set_cluster_max_extent", "get_cluster_max_extent");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "hlod_levels", PROPERTY_HINT_RANGE, "0,8,1"), "set_hlod_levels", "get_hlod_levels");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "hlod_distance", PROPERTY_HINT_RANGE, "0,10000,0.1,or_greater,suffix:m"), "set_hlod_distance", "get_hlod_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "hlod_cell_size", PROPERTY_HINT_RANGE, "0,10000,0.1,or_greater,suffix:m"), "set_hlod_cell_size", "get_hlod_cell_size");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "hlod_reduction", PROPERTY_HINT_RANGE, "0.01,1,0.01"), "set_hlod_reduction", "get_hlod_reduction");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "hlod_max_error", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_hlod_max_error", "get_hlod_max_error");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "optimize_vertex_order"), "set_optimize_vertex_order", "is_optimizing_vertex_order");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "weld_vertices"), "set_weld_vertices", "is_welding_vertices");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_count", PROPERTY_HINT_RANGE, "0,8,1"), "set_lod_count", "get_lod_count");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_reduction", PROPERTY_HINT_RANGE, "0.01,0.99,0.01"), "set_lod_reduction", "get_lod_reduction");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_max_error", PROPERTY_HINT_RANGE, "0,1,0.001"), "set_lod_max_error", "get_lod_max_error");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "thread_budget", PROPERTY_HINT_RANGE, "0,256,1"), "set_thread_budget", "get_thread_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "pack_mode", PROPERTY_HINT_ENUM, "Fast,Brute Force,Auto"), "set_pack_mode", "get_pack_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "generate_uv2"), "set_generate_uv2", "is_generating_uv2");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "merge_mode", PROPERTY_HINT_ENUM, "Atlas,Batch By Material"), "set_merge_mode", "get_merge_mode");
+	BIND_ENUM_CONSTANT(PACK_MODE_FAST);
+	BIND_ENUM_CONSTANT(PACK_MODE_BRUTE_FORCE);
+	BIND_ENUM_CONSTANT(PACK_MODE_AUTO);
+	BIND_ENUM_CONSTANT(MERGE_MODE_ATLAS);
+	BIND_ENUM_CONSTANT(MERGE_MODE_BATCH_BY_MATERIAL);
 }
 
 Node *MeshMergeMaterialRepack::merge(Node *p_root, Node *p_original_root, String p_output_path) {
+	{
+		MutexLock lock(merge_stages_mutex);
+		merge_stages.clear();
+		merge_error = OK;
+	}
+	merge_start_usec = OS::get_singleton()->get_ticks_usec();
 
 	MeshMergeState mesh_merge_state;
 	mesh_merge_state.root = p_root;
 	mesh_merge_state.original_root = p_original_root;
 	mesh_merge_state.output_path = p_output_path;
+	int32_t stage = _begin_stage("scene_scan");
 	mesh_merge_state.mesh_items.resize(1);
-	_find_all_mesh_instances(mesh_merge_state.mesh_items, p_root, p_root);
-	_find_all_animated_meshes(mesh_merge_state.mesh_items, p_root, p_root);
-
+	_find_all_mesh_instances(mesh_merge_state.mesh_items, p_root, p_root, &mesh_merge_state.surfaces);
 	mesh_merge_state.original_mesh_items.resize(1);
-	_find_all_mesh_instances(mesh_merge_state.original_mesh_items, p_original_root, p_original_root);
+	_find_all_mesh_instances(mesh_merge_state.original_mesh_items, p_original_root, p_original_root, nullptr);
+	_end_stage(stage, mesh_merge_state.surfaces.size());
+
+	stage = _begin_stage("animation_filter");
+	_find_all_animated_meshes(mesh_merge_state.mesh_items, p_root, p_root);
 	_find_all_animated_meshes(mesh_merge_state.original_mesh_items, p_original_root, p_original_root);
-	if (mesh_merge_state.original_mesh_items.size() != mesh_merge_state.mesh_items.size()) {
-		return p_root;
+	uint64_t static_surface_count = 0;
+	for (int32_t items_i = 0; items_i < mesh_merge_state.mesh_items.size(); items_i++) {
+		static_surface_count += mesh_merge_state.mesh_items[items_i].meshes.size();
 	}
+	_end_stage(stage, static_surface_count);
 
-	for (int32_t items_i = 0; items_i < mesh_merge_state.mesh_items.size(); items_i++) {
-		p_root = _merge_list(mesh_merge_state, items_i);
+	stage = _begin_stage("clustering");
+	ClusterBudget budget;
+	budget.max_vertices = cluster_max_vertices;
+	budget.max_triangles = cluster_max_triangles;
+	budget.max_extent = cluster_max_extent;
+	_cluster_mesh_items(mesh_merge_state.mesh_items, &mesh_merge_state.original_mesh_items, mesh_merge_state.surfaces, budget);
+	LocalVector<int32_t> hlod_levels_of_groups;
+	_add_hlod_groups(mesh_merge_state.mesh_items, &mesh_merge_state.original_mesh_items, mesh_merge_state.surfaces, hlod_levels_of_groups);
+	_end_stage(stage, mesh_merge_state.mesh_items.size());
+
+	if (mesh_merge_state.original_mesh_items.size() == mesh_merge_state.mesh_items.size()) {
+		// Groups share nothing but read-only surface snapshots, so charting, packing, rasterization, dilation and
+		// compression run for all of them at once. The scene tree is only changed afterwards, in group order, which
+		// puts the merged groups that replace the source meshes before any HLOD proxies.
+		const int32_t group_count = mesh_merge_state.mesh_items.size();
+		mesh_merge_state.groups.resize(group_count);
+		for (int32_t group_i = 0; group_i < group_count; group_i++) {
+			mesh_merge_state.groups[group_i].hlod_level = hlod_levels_of_groups[group_i];
+			_prepare_merge_group(mesh_merge_state, group_i);
+		}
+		// A single group is built here so its stages can spread over the pool. Several groups take one pool task each
+		// and their stages run inline on that task's thread.
+		if (group_count == 1 || is_pool_thread()) {
+			for (int32_t group_i = 0; group_i < group_count; group_i++) {
+				_build_merge_group(group_i, &mesh_merge_state);
+			}
+		} else {
+			WorkerThreadPool::GroupID group_task = WorkerThreadPool::get_singleton()->add_template_group_task(this, &MeshMergeMaterialRepack::_build_merge_group, &mesh_merge_state, group_count, _get_thread_budget(), true, "Scene Merge Build Groups");
+			WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group_task);
+		}
+		for (int32_t group_i = 0; group_i < group_count; group_i++) {
+			p_root = _apply_merge_group(mesh_merge_state, group_i);
+		}
+		_remove_empty_Node3Ds(p_root);
+	} else {
+		_set_merge_error(ERR_INVALID_DATA);
+		ERR_PRINT("The scene to merge and its original do not have the same mesh instances.");
+	}
+	merge_end_usec = OS::get_singleton()->get_ticks_usec();
+	if (!trace_path.is_empty()) {
+		_write_trace(trace_path);
 	}
-	_remove_empty_Node3Ds(p_root);
 	return p_root;
 }
 
-Node *MeshMergeMaterialRepack::_merge_list(MeshMergeState p_mesh_merge_state, int p_index) {
-	Vector<MeshState> mesh_items = p_mesh_merge_state.mesh_items[p_index].meshes;
-	Node *p_root = p_mesh_merge_state.root;
-	Vector<MeshState> original_mesh_items = p_mesh_merge_state.original_mesh_items[p_index].meshes;
-	Array mesh_to_index_to_material;
-	Vector<Ref<Material> > material_cache;
+Error MeshMergeMaterialRepack::rebake(Node *p_root, const String &p_output_path) {
+	ERR_FAIL_NULL_V(p_root, ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V_MSG(merge_mode != MERGE_MODE_ATLAS, ERR_UNAVAILABLE, "Only atlas merges can be re-baked. Batch-by-material merges keep the source textures and write no lookup maps.");
+	{
+		MutexLock lock(merge_stages_mutex);
+		merge_stages.clear();
+	}
+	merge_start_usec = OS::get_singleton()->get_ticks_usec();
+
+	// The scan groups surfaces and orders materials exactly like merge does, so group and material indices line up
+	// with the lookup maps written by the last merge.
+	Vector<MeshMerge> mesh_items;
+	LocalVector<SurfaceSnapshot> surfaces;
+	int32_t stage = _begin_stage("scene_scan");
+	mesh_items.resize(1);
+	_find_all_mesh_instances(mesh_items, p_root, p_root, &surfaces);
+	_end_stage(stage, surfaces.size());
+	stage = _begin_stage("animation_filter");
+	_find_all_animated_meshes(mesh_items, p_root, p_root);
+	_end_stage(stage, mesh_items.size());
+	stage = _begin_stage("clustering");
+	ClusterBudget budget;
+	budget.max_vertices = cluster_max_vertices;
+	budget.max_triangles = cluster_max_triangles;
+	budget.max_extent = cluster_max_extent;
+	_cluster_mesh_items(mesh_items, nullptr, surfaces, budget);
+	LocalVector<int32_t> hlod_levels_of_groups;
+	_add_hlod_groups(mesh_items, nullptr, surfaces, hlod_levels_of_groups);
+	_end_stage(stage, mesh_items.size());
+
+	Error err = OK;
+	for (int32_t items_i = 0; items_i < mesh_items.size(); items_i++) {
+		const Error group_err = _rebake_group(mesh_items[items_i].meshes, surfaces, p_output_path, items_i);
+		if (group_err != OK) {
+			err = group_err;
+		}
+	}
+	merge_end_usec = OS::get_singleton()->get_ticks_usec();
+	if (!trace_path.is_empty()) {
+		_write_trace(trace_path);
+	}
+	return err;
+}
+
+int32_t MeshMergeMaterialRepack::_begin_stage(const String &p_name, int32_t p_group) {
+	MergeStage stage;
+	stage.name = p_name;
+	stage.group = p_group;
+	stage.memory_start = Memory::get_mem_usage();
+	stage.memory_max_start = Memory::get_mem_max_usage();
+	stage.start_usec = OS::get_singleton()->get_ticks_usec();
+	MutexLock lock(merge_stages_mutex);
+	merge_stages.push_back(stage);
+	return merge_stages.size() - 1;
+}
+
+void MeshMergeMaterialRepack::_end_stage(int32_t p_stage, uint64_t p_items) {
+	const uint64_t end_usec = OS::get_singleton()->get_ticks_usec();
+	const uint64_t memory_end = Memory::get_mem_usage();
+	const uint64_t memory_max_end = Memory::get_mem_max_usage();
+	MutexLock lock(merge_stages_mutex);
+	ERR_FAIL_INDEX(p_stage, (int32_t)merge_stages.size());
+	MergeStage &stage = merge_stages[p_stage];
+	stage.end_usec = end_usec;
+	stage.items = p_items;
+	stage.memory_delta = int64_t(memory_end) - int64_t(stage.memory_start);
+	if (memory_max_end > stage.memory_max_start) {
+		stage.memory_peak = memory_max_end - stage.memory_start;
+	}
+}
+
+void MeshMergeMaterialRepack::_set_merge_error(Error p_error) {
+	MutexLock lock(merge_stages_mutex);
+	if (merge_error == OK) {
+		merge_error = p_error;
+	}
+}
+
+Error MeshMergeMaterialRepack::get_merge_error() const {
+	MutexLock lock(merge_stages_mutex);
+	return merge_error;
+}
+
+Dictionary MeshMergeMaterialRepack::get_merge_stats() {
+	MutexLock lock(merge_stages_mutex);
+	Array stages;
+	Dictionary totals;
+	for (const MergeStage &stage : merge_stages) {
+		const uint64_t usec = stage.end_usec > stage.start_usec ? stage.end_usec - stage.start_usec : 0;
+		Dictionary entry;
+		entry["name"] = stage.name;
+		entry["group"] = stage.group;
+		entry["start_usec"] = stage.start_usec - merge_start_usec;
+		entry["usec"] = usec;
+		entry["items"] = stage.items;
+		entry["memory_delta"] = stage.memory_delta;
+		entry["memory_peak"] = stage.memory_peak;
+		stages.push_back(entry);
+
+		Dictionary total = totals.get(stage.name, Dictionary());
+		total["usec"] = uint64_t(total.get("usec", 0)) + usec;
+		total["items"] = uint64_t(total.get("items", 0)) + stage.items;
+		total["calls"] = int64_t(total.get("calls", 0)) + 1;
+		total["memory_peak"] = MAX(uint64_t(total.get("memory_peak", 0)), stage.memory_peak);
+		totals[stage.name] = total;
+	}
+	Dictionary stats;
+	stats["usec"] = merge_end_usec > merge_start_usec ? merge_end_usec - merge_start_usec : 0;
+	stats["memory_peak"] = Memory::get_mem_max_usage();
+	stats["stages"] = stages;
+	stats["totals"] = totals;
+	stats["error"] = merge_error;
+	return stats;
+}
+
+Error MeshMergeMaterialRepack::_write_trace(const String &p_path) {
+	// Chrome trace event format, readable by chrome://tracing and Perfetto. Each merge group gets its own track.
+	Array events;
+	{
+		MutexLock lock(merge_stages_mutex);
+		for (const MergeStage &stage : merge_stages) {
+			Dictionary args;
+			args["items"] = stage.items;
+			args["memory_delta"] = stage.memory_delta;
+			args["memory_peak"] = stage.memory_peak;
+			Dictionary event;
+			event["name"] = stage.name;
+			event["cat"] = "scene_merge";
+			event["ph"] = "X";
+			event["pid"] = 0;
+			event["tid"] = stage.group + 1;
+			event["ts"] = stage.start_usec - merge_start_usec;
+			event["dur"] = stage.end_usec > stage.start_usec ? stage.end_usec - stage.start_usec : 0;
+			event["args"] = args;
+			events.push_back(event);
+		}
+	}
+	Dictionary trace;
+	trace["traceEvents"] = events;
+	trace["displayTimeUnit"] = "ms";
+	Error err = OK;
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V_MSG(file.is_null(), err, "Cannot write scene merge trace to " + p_path + ".");
+	file->store_string(JSON::stringify(trace, "", false));
+	return OK;
+}
+
+void MeshMergeMaterialRepack::set_trace_path(const String &p_path) {
+	trace_path = p_path;
+}
+
+String MeshMergeMaterialRepack::get_trace_path() const {
+	return trace_path;
+}
+
+void MeshMergeMaterialRepack::set_cache_enabled(bool p_enabled) {
+	cache_enabled = p_enabled;
+}
+
+bool MeshMergeMaterialRepack::is_cache_enabled() const {
+	return cache_enabled;
+}
+
+void MeshMergeMaterialRepack::set_cache_dir(const String &p_dir) {
+	cache_dir = p_dir;
+}
+
+String MeshMergeMaterialRepack::get_cache_dir() const {
+	return cache_dir;
+}
+
+void MeshMergeMaterialRepack::set_cluster_max_vertices(int32_t p_count) {
+	cluster_max_vertices = MAX(0, p_count);
+}
+
+int32_t MeshMergeMaterialRepack::get_cluster_max_vertices() const {
+	return cluster_max_vertices;
+}
+
+void MeshMergeMaterialRepack::set_cluster_max_triangles(int32_t p_count) {
+	cluster_max_triangles = MAX(0, p_count);
+}
+
+int32_t MeshMergeMaterialRepack::get_cluster_max_triangles() const {
+	return cluster_max_triangles;
+}
+
+void MeshMergeMaterialRepack::set_cluster_max_extent(float p_extent) {
+	cluster_max_extent = MAX(0.0f, p_extent);
+}
+
+float MeshMergeMaterialRepack::get_cluster_max_extent() const {
+	return cluster_max_extent;
+}
+
+void MeshMergeMaterialRepack::set_hlod_levels(int32_t p_levels) {
+	hlod_levels = CLAMP(p_levels, 0, 8);
+}
+
+int32_t MeshMergeMaterialRepack::get_hlod_levels() const {
+	return hlod_levels;
+}
+
+void MeshMergeMaterialRepack::set_hlod_distance(float p_distance) {
+	hlod_distance = MAX(0.0f, p_distance);
+}
+
+float MeshMergeMaterialRepack::get_hlod_distance() const {
+	return hlod_distance;
+}
+
+void MeshMergeMaterialRepack::set_hlod_cell_size(float p_size) {
+	hlod_cell_size = MAX(0.0f, p_size);
+}
+
+float MeshMergeMaterialRepack::get_hlod_cell_size() const {
+	return hlod_cell_size;
+}
+
+void MeshMergeMaterialRepack::set_hlod_reduction(float p_reduction) {
+	hlod_reduction = CLAMP(p_reduction, 0.01f, 1.0f);
+}
+
+float MeshMergeMaterialRepack::get_hlod_reduction() const {
+	return hlod_reduction;
+}
+
+void MeshMergeMaterialRepack::set_hlod_max_error(float p_error) {
+	hlod_max_error = CLAMP(p_error, 0.0f, 1.0f);
+}
+
+float MeshMergeMaterialRepack::get_hlod_max_error() const {
+	return hlod_max_error;
+}
+
+void MeshMergeMaterialRepack::set_optimize_vertex_order(bool p_enabled) {
+	optimize_vertex_order = p_enabled;
+}
+
+bool MeshMergeMaterialRepack::is_optimizing_vertex_order() const {
+	return optimize_vertex_order;
+}
+
+void MeshMergeMaterialRepack::set_weld_vertices(bool p_enabled) {
+	weld_vertices = p_enabled;
+}
+
+bool MeshMergeMaterialRepack::is_welding_vertices() const {
+	return weld_vertices;
+}
+
+void MeshMergeMaterialRepack::set_lod_count(int32_t p_count) {
+	lod_count = CLAMP(p_count, 0, 8);
+}
+
+int32_t MeshMergeMaterialRepack::get_lod_count() const {
+	return lod_count;
+}
+
+void MeshMergeMaterialRepack::set_lod_reduction(float p_reduction) {
+	lod_reduction = CLAMP(p_reduction, 0.01f, 0.99f);
+}
+
+float MeshMergeMaterialRepack::get_lod_reduction() const {
+	return lod_reduction;
+}
+
+void MeshMergeMaterialRepack::set_lod_max_error(float p_error) {
+	lod_max_error = CLAMP(p_error, 0.0f, 1.0f);
+}
+
+float MeshMergeMaterialRepack::get_lod_max_error() const {
+	return lod_max_error;
+}
+
+void MeshMergeMaterialRepack::set_thread_budget(int32_t p_budget) {
+	thread_budget = MAX(0, p_budget);
+}
+
+int32_t MeshMergeMaterialRepack::get_thread_budget() const {
+	return thread_budget;
+}
+
+void MeshMergeMaterialRepack::set_pack_mode(PackMode p_mode) {
+	pack_mode = p_mode;
+}
+
+MeshMergeMaterialRepack::PackMode MeshMergeMaterialRepack::get_pack_mode() const {
+	return pack_mode;
+}
+
+void MeshMergeMaterialRepack::set_generate_uv2(bool p_enabled) {
+	generate_uv2 = p_enabled;
+}
+
+bool MeshMergeMaterialRepack::is_generating_uv2() const {
+	return generate_uv2;
+}
+
+void MeshMergeMaterialRepack::set_merge_mode(MergeMode p_mode) {
+	merge_mode = p_mode;
+}
+
+MeshMergeMaterialRepack::MergeMode MeshMergeMaterialRepack::get_merge_mode() const {
+	return merge_mode;
+}
+
+int32_t MeshMergeMaterialRepack::_get_thread_budget() const {
+	const int32_t pool_threads = MAX(1, WorkerThreadPool::get_singleton()->get_thread_count());
+	return thread_budget > 0 ? MIN(thread_budget, pool_threads) : pool_threads;
+}
+
+// Bumped whenever the merge output changes for identical input, which invalidates every cached group.
+static const uint32_t merge_cache_version = 2;
+
+static void hash_data(CryptoCore::SHA256Context &r_context, const void *p_data, size_t p_size) {
+	r_context.update(static_cast<const uint8_t *>(p_data), p_size);
+}
+
+static void hash_string(CryptoCore::SHA256Context &r_context, const String &p_string) {
+	const CharString utf8 = p_string.utf8();
+	const uint32_t length = utf8.length();
+	hash_data(r_context, &length, sizeof(length));
+	hash_data(r_context, utf8.get_data(), length);
+}
+
+static void hash_texture(CryptoCore::SHA256Context &r_context, const Ref<Texture2D> &p_texture) {
+	// Imported textures are identified by their source file and import settings, so nothing is read back from the GPU.
+	const String path = p_texture->get_path();
+	if (path.is_resource_file() && FileAccess::exists(path)) {
+		hash_string(r_context, path);
+		hash_string(r_context, FileAccess::get_md5(path));
+		if (FileAccess::exists(path + ".import")) {
+			hash_string(r_context, FileAccess::get_md5(path + ".import"));
+		}
+		return;
+	}
+	const Ref<Image> image = p_texture->get_image();
+	if (image.is_null()) {
+		hash_string(r_context, p_texture->get_class());
+		return;
+	}
+	const int32_t header[3] = { image->get_width(), image->get_height(), image->get_format() };
+	hash_data(r_context, header, sizeof(header));
+	const Vector<uint8_t> data = image->get_data();
+	hash_data(r_context, data.ptr(), data.size());
+}
+
+static void hash_variant(CryptoCore::SHA256Context &r_context, const Variant &p_value, int32_t p_depth) {
+	const int32_t type = p_value.get_type();
+	hash_data(r_context, &type, sizeof(type));
+	if (type == Variant::OBJECT) {
+		const Object *object = p_value;
+		if (!object) {
+			return;
+		}
+		const Ref<Texture2D> texture = p_value;
+		if (texture.is_valid()) {
+			hash_texture(r_context, texture);
+			return;
+		}
+		hash_string(r_context, object->get_class());
+		if (p_depth > 4) {
+			return;
+		}
+		// Materials, including their next passes, are compared through every stored property.
+		List<PropertyInfo> properties;
+		object->get_property_list(&properties);
+		for (const PropertyInfo &property : properties) {
+			if (!(property.usage & PROPERTY_USAGE_STORAGE)) {
+				continue;
+			}
+			hash_string(r_context, property.name);
+			hash_variant(r_context, object->get(property.name), p_depth + 1);
+		}
+		return;
+	}
+	if (type == Variant::ARRAY) {
+		const Array array = p_value;
+		for (int32_t element_i = 0; element_i < array.size(); element_i++) {
+			hash_variant(r_context, array[element_i], p_depth + 1);
+		}
+		return;
+	}
+	int length = 0;
+	encode_variant(p_value, nullptr, length);
+	Vector<uint8_t> buffer;
+	buffer.resize(length);
+	encode_variant(p_value, buffer.ptrw(), length);
+	hash_data(r_context, buffer.ptr(), buffer.size());
+}
+
+static void hash_pack_options(CryptoCore::SHA256Context &r_context, const xatlas::PackOptions &p_pack_options) {
+	const uint32_t pack_sizes[2] = { p_pack_options.padding, p_pack_options.resolution };
+	const uint8_t pack_flags[3] = { p_pack_options.bilinear, p_pack_options.blockAlign, p_pack_options.bruteForce };
+	hash_data(r_context, pack_sizes, sizeof(pack_sizes));
+	hash_data(r_context, pack_flags, sizeof(pack_flags));
+	hash_data(r_context, &p_pack_options.texelsPerUnit, sizeof(p_pack_options.texelsPerUnit));
+}
+
+String MeshMergeMaterialRepack::_hash_merge_group(int32_t p_hlod_level, const Vector<MeshState> &p_mesh_items, const Vector<MeshState> &p_original_mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces,
+		const Vector<Ref<Material> > &p_material_cache, const xatlas::PackOptions &p_pack_options) {
+	CryptoCore::SHA256Context context;
+	context.start();
+	hash_data(context, &merge_cache_version, sizeof(merge_cache_version));
+	hash_pack_options(context, p_pack_options);
+	const uint8_t flags[4] = { generate_uv2, (uint8_t)merge_mode, optimize_vertex_order, weld_vertices };
+	hash_data(context, flags, sizeof(flags));
+	const float lod_settings[3] = { (float)lod_count, lod_reduction, lod_max_error };
+	hash_data(context, lod_settings, sizeof(lod_settings));
+	if (p_hlod_level > 0) {
+		const float hlod_settings[4] = { (float)p_hlod_level, hlod_reduction, hlod_max_error, hlod_cell_size };
+		hash_data(context, hlod_settings, sizeof(hlod_settings));
+	}
+	for (int32_t material_i = 0; material_i < p_material_cache.size(); material_i++) {
+		hash_variant(context, p_material_cache[material_i], 0);
+	}
+	for (int32_t mesh_i = 0; mesh_i < p_mesh_items.size(); mesh_i++) {
+		const SurfaceSnapshot &surface = p_surfaces[p_mesh_items[mesh_i].surface_id];
+		const uint32_t counts[3] = { surface.positions.size(), surface.indices.size(), (uint32_t)surface.material_id };
+		hash_data(context, counts, sizeof(counts));
+		hash_data(context, surface.positions.ptr(), sizeof(Vector3) * surface.positions.size());
+		hash_data(context, surface.normals.ptr(), sizeof(Vector3) * surface.normals.size());
+		hash_data(context, surface.uvs.ptr(), sizeof(Vector2) * surface.uvs.size());
+		hash_data(context, surface.uv2s.ptr(), sizeof(Vector2) * surface.uv2s.size());
+		hash_data(context, surface.indices.ptr(), sizeof(uint32_t) * surface.indices.size());
+		const Transform3D xform = get_scene_global_transform(p_original_mesh_items[mesh_i].mesh_instance);
+		hash_data(context, &xform, sizeof(xform));
+	}
+	unsigned char hash[32];
+	context.finish(hash);
+	return String::hex_encode_buffer(hash, 32);
+}
+
+String MeshMergeMaterialRepack::_get_cache_path(const String &p_output_path, const String &p_hash, const String &p_extension) const {
+	const String dir = cache_dir.is_empty() ? p_output_path.get_base_dir().path_join(".scene_merge_cache") : cache_dir;
+	return dir.path_join(p_hash + "." + p_extension);
+}
+
+String MeshMergeMaterialRepack::_get_cache_temp_path(const String &p_path) const {
+	// Unique to this process and thread, so concurrent merges of the same group never write the same file. The
+	// extension is kept because ResourceSaver picks the format from it.
+	return p_path.get_basename() + "." + itos(OS::get_singleton()->get_process_id()) + "_" + itos(Thread::get_caller_id()) + ".tmp." + p_path.get_extension();
+}
+
+Error MeshMergeMaterialRepack::_commit_cache_file(const String &p_temp_path, Error p_error, const String &p_path) {
+	// Entries only appear under their final name once fully written, so a reader never loads a partial file.
+	if (p_error == OK) {
+		p_error = DirAccess::rename_absolute(p_temp_path, p_path);
+	}
+	if (p_error == OK) {
+		return OK;
+	}
+	if (FileAccess::exists(p_temp_path)) {
+		DirAccess::remove_absolute(p_temp_path);
+	}
+	// A missing entry only costs a rebuild on the next merge, so the merge itself goes on.
+	ERR_PRINT("Cannot write scene merge cache entry " + p_path + ".");
+	return p_error;
+}
+
+void MeshMergeMaterialRepack::_prepare_merge_group(MeshMergeState &p_mesh_merge_state, int p_index) {
+	MergeGroupJob &job = p_mesh_merge_state.groups[p_index];
+	job.mesh_items = p_mesh_merge_state.mesh_items[p_index].meshes;
+	job.name = p_mesh_merge_state.root->get_name();
+	const Vector<MeshState> &original_mesh_items = p_mesh_merge_state.original_mesh_items[p_index].meshes;
 	Ref<Material> empty_material;
-	material_cache.push_back(empty_material);
-	map_mesh_to_index_to_material(mesh_items, mesh_to_index_to_material, material_cache);
+	job.material_cache.push_back(empty_material);
+	LocalVector<SurfaceSnapshot> &surfaces = p_mesh_merge_state.surfaces;
+	map_mesh_to_material(job.mesh_items, surfaces, job.material_cache);
+	xatlas::PackOptions &pack_options = job.pack_options;
+	pack_options.bilinear = true;
+	pack_options.padding = 16;
+	pack_options.texelsPerUnit = 0.0f;
+	pack_options.bruteForce = pack_mode == PACK_MODE_BRUTE_FORCE;
+	if (pack_mode == PACK_MODE_AUTO) {
+		// xatlas packs on its own threads, one per processor, which the pool budget does not cover. Brute force only
+		// pays off when the groups packing at once leave processors idle.
+		const int32_t concurrent_packs = MIN(_get_thread_budget(), (int32_t)p_mesh_merge_state.groups.size());
+		pack_options.bruteForce = OS::get_singleton()->get_processor_count() > concurrent_packs;
+	}
+	pack_options.blockAlign = true;
+	// Proxies cover more of the scene per texel the higher their level, so their atlas shrinks with every level.
+	pack_options.resolution = MAX(2048 >> job.hlod_level, 256);
 
-	Vector<Vector<Vector2> > uv_groups;
-	Vector<Vector<ModelVertex> > model_vertices;
-	scale_uvs_by_texture_dimension(original_mesh_items, mesh_items, uv_groups, mesh_to_index_to_material, model_vertices);
-	xatlas::SetPrint(printf, true);
-	xatlas::Atlas *atlas = xatlas::Create();
+	// A group whose geometry, materials, textures, transforms and pack options are unchanged reuses its last result.
+	if (cache_enabled) {
+		const int32_t stage = _begin_stage("cache_lookup", p_index);
+		job.cache_path = _get_cache_path(p_mesh_merge_state.output_path, _hash_merge_group(job.hlod_level, job.mesh_items, original_mesh_items, surfaces, job.material_cache, pack_options), "res");
+		if (FileAccess::exists(job.cache_path)) {
+			job.merged_mesh = ResourceLoader::load(job.cache_path, "ArrayMesh", ResourceFormatLoader::CACHE_MODE_IGNORE);
+		}
+		if (job.merged_mesh.is_valid()) {
+			// The loaded mesh can still carry the entry's path, and merged scenes would then reference the cache file
+			// instead of embedding the mesh.
+			job.merged_mesh->set_path(String());
+		}
+		job.cache_hit = job.merged_mesh.is_valid() && (merge_mode != MERGE_MODE_BATCH_BY_MATERIAL || _bind_batch_materials(job, surfaces));
+		_end_stage(stage, job.cache_hit ? 1 : 0);
+		if (job.cache_hit) {
+			return;
+		}
+	}
 
-	int32_t num_surfaces = 0;
-	for (int32_t mesh_i = 0; mesh_i < mesh_items.size(); mesh_i++) {
-		for (int32_t j = 0; j < mesh_items[mesh_i].mesh->get_surface_count(); j++) {
-			num_surfaces++;
+	// Node transforms and source textures are only touched here, on the thread that called merge. That need not be the
+	// main thread, but it must own both scene trees for the duration of the merge.
+	if (merge_mode == MERGE_MODE_BATCH_BY_MATERIAL) {
+		_transform_surfaces(original_mesh_items, job.mesh_items, surfaces, job.model_vertices);
+	} else {
+		scale_uvs_by_texture_dimension(original_mesh_items, job.mesh_items, surfaces, job.material_cache, job.uv_groups, job.model_vertices);
+		_cache_material_images(job.material_cache, job.material_image_cache, p_index);
+	}
+	if (generate_uv2) {
+		job.has_source_uv2 = _pack_source_uv2(job.mesh_items, surfaces, job.model_vertices);
+	}
+}
+
+void MeshMergeMaterialRepack::_build_merge_group(uint32_t p_index, MeshMergeState *p_mesh_merge_state) {
+	MergeGroupJob &job = p_mesh_merge_state->groups[p_index];
+	if (job.cache_hit) {
+		return;
+	}
+	const LocalVector<SurfaceSnapshot> &surfaces = p_mesh_merge_state->surfaces;
+	if (merge_mode == MERGE_MODE_BATCH_BY_MATERIAL) {
+		job.merged_mesh = _build_material_batches(job, surfaces, p_index);
+	} else {
+		job.merged_mesh = _build_atlas_group(job, *p_mesh_merge_state, p_index);
+	}
+	if (job.merged_mesh.is_null()) {
+		_set_merge_error(ERR_CANT_CREATE);
+		ERR_FAIL_MSG("Can't build merge group " + itos(p_index) + ".");
+	}
+	if (job.hlod_level > 0) {
+		job.merged_mesh = _simplify_hlod_proxy(job.merged_mesh, job.hlod_level, p_index);
+	}
+	if (generate_uv2 && !job.has_source_uv2) {
+		// One unwrap of the merged mesh replaces unwrapping every source mesh. Groups build concurrently, so their
+		// unwraps run in parallel.
+		const int32_t stage = _begin_stage("uv2_unwrap", p_index);
+		job.merged_mesh->lightmap_unwrap(Transform3D(), 2.0f, true);
+		_end_stage(stage, job.merged_mesh->get_surface_count() ? job.merged_mesh->surface_get_array_len(0) : 0);
+		if (optimize_vertex_order || weld_vertices || lod_count > 0) {
+			// The unwrap rebuilds every surface without LODs and in its own vertex order, so finish them again.
+			const Ref<ArrayMesh> unwrapped_mesh = job.merged_mesh;
+			job.merged_mesh.instantiate();
+			for (int32_t surface_i = 0; surface_i < unwrapped_mesh->get_surface_count(); surface_i++) {
+				Array arrays = unwrapped_mesh->surface_get_arrays(surface_i);
+				_add_merged_surface(job.merged_mesh, arrays, unwrapped_mesh->surface_get_material(surface_i), p_index);
+			}
+		}
+	}
+	if (job.cache_path.is_empty()) {
+		return;
+	}
+	DirAccess::make_dir_recursive_absolute(ProjectSettings::get_singleton()->globalize_path(job.cache_path.get_base_dir()));
+	if (merge_mode == MERGE_MODE_BATCH_BY_MATERIAL) {
+		// Batches keep the shared source materials, so the entry is stored without them and they are bound again on
+		// load instead of every entry carrying private copies of the materials and their textures.
+		Vector<Ref<Material> > surface_materials;
+		for (int32_t surface_i = 0; surface_i < job.merged_mesh->get_surface_count(); surface_i++) {
+			surface_materials.push_back(job.merged_mesh->surface_get_material(surface_i));
+			job.merged_mesh->surface_set_material(surface_i, Ref<Material>());
+		}
+		const String temp_path = _get_cache_temp_path(job.cache_path);
+		_commit_cache_file(temp_path, ResourceSaver::save(job.merged_mesh, temp_path, ResourceSaver::FLAG_COMPRESS), job.cache_path);
+		for (int32_t surface_i = 0; surface_i < surface_materials.size(); surface_i++) {
+			job.merged_mesh->surface_set_material(surface_i, surface_materials[surface_i]);
+		}
+		return;
+	}
+	// Atlas textures are bundled into the cached mesh, so the cache entry stays valid whatever happens to the output files.
+	const String temp_path = _get_cache_temp_path(job.cache_path);
+	_commit_cache_file(temp_path, ResourceSaver::save(job.merged_mesh, temp_path, ResourceSaver::FLAG_BUNDLE_RESOURCES | ResourceSaver::FLAG_COMPRESS), job.cache_path);
+}
+
+Ref<ArrayMesh> MeshMergeMaterialRepack::_build_atlas_group(MergeGroupJob &p_job, const MeshMergeState &p_mesh_merge_state, int p_index) {
+	const LocalVector<SurfaceSnapshot> &surfaces = p_mesh_merge_state.surfaces;
+	// Charts and packing only depend on the scaled UVs, indices, face materials and pack options, so a texture-only
+	// change reuses the atlas layout of the previous merge and goes straight to rasterization.
+	AtlasResult atlas;
+	String atlas_path;
+	bool atlas_loaded = false;
+	if (cache_enabled) {
+		const int32_t stage = _begin_stage("atlas_load", p_index);
+		atlas_path = _get_cache_path(p_mesh_merge_state.output_path, _hash_atlas_input(p_job.uv_groups, p_job.mesh_items, surfaces, p_job.pack_options), "atlas");
+		atlas_loaded = FileAccess::exists(atlas_path) && _load_atlas(atlas_path, p_job.uv_groups, atlas) == OK;
+		_end_stage(stage, atlas_loaded ? 1 : 0);
+	}
+	if (!atlas_loaded) {
+		_generate_atlas(p_job.uv_groups, p_job.mesh_items, surfaces, p_job.pack_options, p_index, atlas);
+		if (!atlas_path.is_empty()) {
+			DirAccess::make_dir_recursive_absolute(ProjectSettings::get_singleton()->globalize_path(atlas_path.get_base_dir()));
+			const String temp_path = _get_cache_temp_path(atlas_path);
+			_commit_cache_file(temp_path, _save_atlas(temp_path, atlas), atlas_path);
 		}
 	}
-	xatlas::PackOptions pack_options;
 	Vector<AtlasLookupTexel> atlas_lookup;
-	_generate_atlas(num_surfaces, uv_groups, atlas, mesh_items, material_cache, pack_options);
-	atlas_lookup.resize(atlas->width * atlas->height);
-	HashMap<String, Ref<Image> > texture_atlas;
+	atlas_lookup.resize(atlas.width * atlas.height);
 
 	MergeState state = {
-		p_root, atlas,
-		mesh_items,
-		mesh_to_index_to_material,
-		uv_groups,
-		model_vertices,
-		p_root->get_name(),
+		p_mesh_merge_state.root, &atlas,
+		p_job.mesh_items,
+		p_job.uv_groups,
+		p_job.model_vertices,
+		p_job.name,
 		p_mesh_merge_state.output_path,
-		pack_options,
+		p_job.pack_options,
 		atlas_lookup,
-		material_cache,
-		texture_atlas
+		p_job.material_cache,
 	};
+	state.material_image_cache = p_job.material_image_cache;
+	state.group = p_index;
+	state.has_uv2 = p_job.has_source_uv2;
+	_generate_texture_atlas(state);
+	Ref<ArrayMesh> merged_mesh = _build_output(state, p_index);
+	if (merged_mesh.is_null()) {
+		return merged_mesh;
+	}
+	const Error err = _save_lookup(_get_lookup_path(p_mesh_merge_state.output_path, p_index), atlas.width, atlas.height, p_job.material_cache.size(), atlas_lookup);
+	if (err != OK) {
+		_set_merge_error(err);
+	}
+	if (!p_job.cache_path.is_empty()) {
+		DirAccess::make_dir_recursive_absolute(ProjectSettings::get_singleton()->globalize_path(p_job.cache_path.get_base_dir()));
+		const String lookup_path = p_job.cache_path.get_basename() + ".lookup";
+		const String temp_path = _get_cache_temp_path(lookup_path);
+		if (_commit_cache_file(temp_path, _save_lookup(temp_path, atlas.width, atlas.height, p_job.material_cache.size(), atlas_lookup), lookup_path) != OK) {
+			// A cached mesh without its lookup map could not be re-baked after a cache hit, so it is not stored either.
+			p_job.cache_path = String();
+		}
+	}
+	return merged_mesh;
+}
+
+// Tangents for a whole indexed surface in one mikktspace pass, straight from its packed arrays, with the same
+// handedness SurfaceTool::generate_tangents gives.
+struct TangentGenerationData {
+	const Vector3 *positions = nullptr;
+	const Vector3 *normals = nullptr;
+	const Vector2 *uvs = nullptr;
+	const int32_t *indices = nullptr;
+	int32_t face_count = 0;
+	float *tangents = nullptr;
+};
+
+static int mikkt_get_num_faces(const SMikkTSpaceContext *p_context) {
+	return ((const TangentGenerationData *)p_context->m_pUserData)->face_count;
+}
+
+static int mikkt_get_num_vertices_of_face(const SMikkTSpaceContext *p_context, const int p_face) {
+	return 3;
+}
+
+static void mikkt_get_position(const SMikkTSpaceContext *p_context, float r_position[], const int p_face, const int p_vertex) {
+	const TangentGenerationData &data = *(const TangentGenerationData *)p_context->m_pUserData;
+	const Vector3 &position = data.positions[data.indices[p_face * 3 + p_vertex]];
+	r_position[0] = position.x;
+	r_position[1] = position.y;
+	r_position[2] = position.z;
+}
+
+static void mikkt_get_normal(const SMikkTSpaceContext *p_context, float r_normal[], const int p_face, const int p_vertex) {
+	const TangentGenerationData &data = *(const TangentGenerationData *)p_context->m_pUserData;
+	const Vector3 &normal = data.normals[data.indices[p_face * 3 + p_vertex]];
+	r_normal[0] = normal.x;
+	r_normal[1] = normal.y;
+	r_normal[2] = normal.z;
+}
+
+static void mikkt_get_tex_coord(const SMikkTSpaceContext *p_context, float r_uv[], const int p_face, const int p_vertex) {
+	const TangentGenerationData &data = *(const TangentGenerationData *)p_context->m_pUserData;
+	const Vector2 &uv = data.uvs[data.indices[p_face * 3 + p_vertex]];
+	r_uv[0] = uv.x;
+	r_uv[1] = uv.y;
+}
+
+static void mikkt_set_tspace(const SMikkTSpaceContext *p_context, const float p_tangent[], const float p_bitangent[], const float p_mag_s, const float p_mag_t,
+		const tbool p_orientation_preserving, const int p_face, const int p_vertex) {
+	const TangentGenerationData &data = *(const TangentGenerationData *)p_context->m_pUserData;
+	const int32_t index = data.indices[p_face * 3 + p_vertex];
+	const Vector3 tangent = Vector3(p_tangent[0], p_tangent[1], p_tangent[2]);
+	const Vector3 binormal = Vector3(-p_bitangent[0], -p_bitangent[1], -p_bitangent[2]);
+	float *out = data.tangents + index * 4;
+	out[0] = tangent.x;
+	out[1] = tangent.y;
+	out[2] = tangent.z;
+	out[3] = binormal.dot(data.normals[index].cross(tangent)) < 0 ? -1.0f : 1.0f;
+}
+
+static void generate_tangents(Array &r_arrays) {
+	const PackedVector3Array positions = r_arrays[Mesh::ARRAY_VERTEX];
+	const PackedVector3Array normals = r_arrays[Mesh::ARRAY_NORMAL];
+	const PackedVector2Array uvs = r_arrays[Mesh::ARRAY_TEX_UV];
+	const PackedInt32Array indices = r_arrays[Mesh::ARRAY_INDEX];
+	ERR_FAIL_COND(normals.size() != positions.size() || uvs.size() != positions.size());
+	PackedFloat32Array tangents;
+	tangents.resize(positions.size() * 4);
+	TangentGenerationData data;
+	data.positions = positions.ptr();
+	data.normals = normals.ptr();
+	data.uvs = uvs.ptr();
+	data.indices = indices.ptr();
+	data.face_count = indices.size() / 3;
+	data.tangents = tangents.ptrw();
+	// Vertices no face references keep a valid default.
+	for (int32_t vertex_i = 0; vertex_i < positions.size(); vertex_i++) {
+		data.tangents[vertex_i * 4 + 0] = 1.0f;
+		data.tangents[vertex_i * 4 + 1] = 0.0f;
+		data.tangents[vertex_i * 4 + 2] = 0.0f;
+		data.tangents[vertex_i * 4 + 3] = 1.0f;
+	}
+	SMikkTSpaceInterface mikkt_interface;
+	mikkt_interface.m_getNumFaces = mikkt_get_num_faces;
+	mikkt_interface.m_getNumVerticesOfFace = mikkt_get_num_vertices_of_face;
+	mikkt_interface.m_getPosition = mikkt_get_position;
+	mikkt_interface.m_getNormal = mikkt_get_normal;
+	mikkt_interface.m_getTexCoord = mikkt_get_tex_coord;
+	mikkt_interface.m_setTSpaceBasic = nullptr;
+	mikkt_interface.m_setTSpace = mikkt_set_tspace;
+	SMikkTSpaceContext mikkt_context;
+	mikkt_context.m_pInterface = &mikkt_interface;
+	mikkt_context.m_pUserData = &data;
+	ERR_FAIL_COND(!genTangSpaceDefault(&mikkt_context));
+	r_arrays[Mesh::ARRAY_TANGENT] = tangents;
+}
+
+Ref<ArrayMesh> MeshMergeMaterialRepack::_build_material_batches(const MergeGroupJob &p_job, const LocalVector<SurfaceSnapshot> &p_surfaces, int p_index) {
+	const int32_t stage = _begin_stage("material_batch", p_index);
+	uint64_t vertex_count = 0;
+	Ref<ArrayMesh> array_mesh;
+	array_mesh.instantiate();
+	// One surface per distinct material, with every surface using it appended in scene order.
+	for (int32_t material_i = 0; material_i < p_job.material_cache.size(); material_i++) {
+		int32_t batch_vertex_count = 0;
+		int32_t batch_index_count = 0;
+		for (int32_t mesh_i = 0; mesh_i < p_job.mesh_items.size(); mesh_i++) {
+			const SurfaceSnapshot &surface = p_surfaces[p_job.mesh_items[mesh_i].surface_id];
+			if (surface.material_id == material_i && !surface.indices.is_empty()) {
+				batch_vertex_count += p_job.model_vertices[mesh_i].size();
+				batch_index_count += surface.indices.size();
+			}
+		}
+		if (batch_index_count == 0) {
+			continue;
+		}
+		PackedVector3Array positions;
+		PackedVector3Array normals;
+		PackedVector2Array uvs;
+		PackedVector2Array uv2s;
+		PackedInt32Array indices;
+		positions.resize(batch_vertex_count);
+		normals.resize(batch_vertex_count);
+		uvs.resize(batch_vertex_count);
+		uv2s.resize(p_job.has_source_uv2 ? batch_vertex_count : 0);
+		indices.resize(batch_index_count);
+		Vector3 *positions_w = positions.ptrw();
+		Vector3 *normals_w = normals.ptrw();
+		Vector2 *uvs_w = uvs.ptrw();
+		Vector2 *uv2s_w = uv2s.ptrw();
+		int32_t *indices_w = indices.ptrw();
+		int32_t base_vertex = 0;
+		int32_t base_index = 0;
+		for (int32_t mesh_i = 0; mesh_i < p_job.mesh_items.size(); mesh_i++) {
+			const SurfaceSnapshot &surface = p_surfaces[p_job.mesh_items[mesh_i].surface_id];
+			if (surface.material_id != material_i || surface.indices.is_empty()) {
+				continue;
+			}
+			const Vector<ModelVertex> &model_vertices = p_job.model_vertices[mesh_i];
+			const ModelVertex *model_vertices_r = model_vertices.ptr();
+			for (int32_t vertex_i = 0; vertex_i < model_vertices.size(); vertex_i++) {
+				positions_w[base_vertex + vertex_i] = model_vertices_r[vertex_i].pos;
+				normals_w[base_vertex + vertex_i] = model_vertices_r[vertex_i].normal;
+				uvs_w[base_vertex + vertex_i] = model_vertices_r[vertex_i].uv;
+			}
+			if (p_job.has_source_uv2) {
+				for (int32_t vertex_i = 0; vertex_i < model_vertices.size(); vertex_i++) {
+					uv2s_w[base_vertex + vertex_i] = model_vertices_r[vertex_i].uv2;
+				}
+			}
+			for (uint32_t index_i = 0; index_i < surface.indices.size(); index_i++) {
+				indices_w[base_index + index_i] = base_vertex + surface.indices[index_i];
+			}
+			base_vertex += model_vertices.size();
+			base_index += surface.indices.size();
+		}
+		vertex_count += batch_vertex_count;
+		Array arrays;
+		arrays.resize(Mesh::ARRAY_MAX);
+		arrays[Mesh::ARRAY_VERTEX] = positions;
+		arrays[Mesh::ARRAY_NORMAL] = normals;
+		arrays[Mesh::ARRAY_TEX_UV] = uvs;
+		if (p_job.has_source_uv2) {
+			arrays[Mesh::ARRAY_TEX_UV2] = uv2s;
+		}
+		arrays[Mesh::ARRAY_INDEX] = indices;
+		const Ref<BaseMaterial3D> base_material = p_job.material_cache[material_i];
+		if (base_material.is_valid() && base_material->get_feature(BaseMaterial3D::FEATURE_NORMAL_MAPPING)) {
+			generate_tangents(arrays);
+		}
+		_add_merged_surface(array_mesh, arrays, p_job.material_cache[material_i], p_index);
+	}
+	_end_stage(stage, vertex_count);
+	if (array_mesh->get_surface_count() == 0) {
+		return Ref<ArrayMesh>();
+	}
+	return array_mesh;
+}
+
+bool MeshMergeMaterialRepack::_bind_batch_materials(MergeGroupJob &p_job, const LocalVector<SurfaceSnapshot> &p_surfaces) {
+	// Surfaces were built in material order, one for every material with geometry.
+	int32_t surface_i = 0;
+	for (int32_t material_i = 0; material_i < p_job.material_cache.size(); material_i++) {
+		bool used = false;
+		for (int32_t mesh_i = 0; mesh_i < p_job.mesh_items.size() && !used; mesh_i++) {
+			const SurfaceSnapshot &surface = p_surfaces[p_job.mesh_items[mesh_i].surface_id];
+			used = surface.material_id == material_i && !surface.indices.is_empty();
+		}
+		if (!used) {
+			continue;
+		}
+		ERR_FAIL_COND_V_MSG(surface_i >= p_job.merged_mesh->get_surface_count(), false, "Cached material batch does not match its merge group, rebuilding it.");
+		p_job.merged_mesh->surface_set_material(surface_i, p_job.material_cache[material_i]);
+		surface_i++;
+	}
+	ERR_FAIL_COND_V_MSG(surface_i != p_job.merged_mesh->get_surface_count(), false, "Cached material batch does not match its merge group, rebuilding it.");
+	return true;
+}
+
+Node *MeshMergeMaterialRepack::_apply_merge_group(MeshMergeState &p_mesh_merge_state, int p_index) {
+	MergeGroupJob &job = p_mesh_merge_state.groups[p_index];
+	Node *root = p_mesh_merge_state.root;
+	ERR_FAIL_COND_V(job.merged_mesh.is_null(), root);
+	if (job.cache_hit) {
+		const String cached_lookup_path = job.cache_path.get_basename() + ".lookup";
+		if (FileAccess::exists(cached_lookup_path)) {
+			const Error err = DirAccess::copy_absolute(cached_lookup_path, _get_lookup_path(p_mesh_merge_state.output_path, p_index));
+			if (err != OK) {
+				_set_merge_error(err);
+				ERR_PRINT("Can't copy the cached lookup map " + cached_lookup_path + " next to the output.");
+			}
+		}
+	}
+	if (merge_mode == MERGE_MODE_ATLAS) {
+		_save_output_textures(job.merged_mesh, p_mesh_merge_state.output_path, p_index);
+	}
+	return _apply_output(root, job.mesh_items, job.merged_mesh, job.name, job.hlod_level);
+}
+
+void MeshMergeMaterialRepack::_cache_material_images(const Vector<Ref<Material> > &p_material_cache, HashMap<int32_t, MaterialImageCache> &r_material_image_cache, int32_t p_group) {
+	const int32_t stage = _begin_stage("source_decode", p_group);
 #ifdef TOOLS_ENABLED
-	EditorProgress progress_scene_merge("gen_get_source_material", TTR("Get source material"), state.material_cache.size());
+	EditorProgress *progress_scene_merge = nullptr;
+	if (can_show_editor_progress()) {
+		progress_scene_merge = memnew(EditorProgress("gen_get_source_material", TTR("Get source material"), p_material_cache.size()));
+	}
 	int step = 0;
 #endif
-	for (int32_t material_cache_i = 0; material_cache_i < state.material_cache.size(); material_cache_i++) {
+	for (int32_t material_cache_i = 0; material_cache_i < p_material_cache.size(); material_cache_i++) {
 #ifdef TOOLS_ENABLED
 		step++;
 #endif
-		Ref<BaseMaterial3D> material = state.material_cache[material_cache_i];
+		Ref<BaseMaterial3D> material = p_material_cache[material_cache_i];
 		if (material.is_null()) {
 			continue;
 		}
-		if (material->get_texture(BaseMaterial3D::TEXTURE_ALBEDO).is_null()) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			img->fill(material->get_albedo());
-			material->set_albedo(Color(1.0f, 1.0f, 1.0f));
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, tex);
-		}
-		if (material->get_texture(BaseMaterial3D::TEXTURE_EMISSION).is_null()) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			img->fill(material->get_emission());
-
-			Color emission_col = material->get_emission();
-			float emission_energy = material->get_emission_energy_multiplier();
-			Color color_mul;
-			Color color_add;
-			if (material->get_emission_operator() == BaseMaterial3D::EMISSION_OP_ADD) {
-				color_mul = Color(1, 1, 1) * emission_energy;
-				color_add = emission_col * emission_energy;
-			} else {
-				color_mul = emission_col * emission_energy;
-				color_add = Color(0, 0, 0);
+		// Missing maps are not filled in. Their layers sample a single texel of the material's constant value, and the
+		// ORM channels fall back to the scalar values.
+		const MaterialSourceImages source_images = _decode_source_images(material);
+		MaterialImageCache cache;
+		for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+			Ref<Image> img = _get_source_texture(source_images, material, AtlasTextureType(texture_i));
+			if (img.is_null() || img->is_empty()) {
+				continue;
 			}
-			material->set_feature(BaseMaterial3D::FEATURE_EMISSION, true);
-			Color c;
-			c.r = c.r * color_mul.r + color_add.r;
-			c.g = c.g * color_mul.g + color_add.g;
-			c.b = c.b * color_mul.b + color_add.b;
-			material->set_emission(c);
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_texture(BaseMaterial3D::TEXTURE_EMISSION, tex);
-		}
-		if (material->get_texture(BaseMaterial3D::TEXTURE_ROUGHNESS).is_null()) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			float roughness = material->get_roughness();
-			Color c = Color(roughness, roughness, roughness);
-			material->set_roughness(1.0f);
-			img->fill(c);
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_roughness_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_GREEN);
-			material->set_texture(BaseMaterial3D::TEXTURE_ROUGHNESS, tex);
-		}
-		if (material->get_texture(BaseMaterial3D::TEXTURE_METALLIC).is_null()) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			float metallic = material->get_metallic();
-			Color c = Color(metallic, metallic, metallic);
-			material->set_metallic(1.0f);
-			img->fill(c);
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_metallic_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_GREEN);
-			material->set_texture(BaseMaterial3D::TEXTURE_METALLIC, tex);
-		}
-		if (material->get_texture(BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION).is_null()) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			float ao = 1.0f;
-			Color c = Color(ao, ao, ao);
-			img->fill(c);
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_ao_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_GREEN);
-			material->set_texture(BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION, tex);
-		}
-		if (!material->get_feature(BaseMaterial3D::FEATURE_NORMAL_MAPPING)) {
-			Ref<Image> img = Image::create_empty(default_texture_length, default_texture_length, true, Image::FORMAT_RGBA8);
-			Color c = Color(0.5f, 0.5f, 1.0f);
-			img->fill(c);
-			Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-			material->set_feature(BaseMaterial3D::FEATURE_NORMAL_MAPPING, true);
-			material->set_texture(BaseMaterial3D::TEXTURE_NORMAL, tex);
+			img->convert(Image::FORMAT_RGBA8);
+			cache.images[texture_i] = img;
 		}
-		MaterialImageCache cache;
-		cache.albedo_img = _get_source_texture(state, material, "albedo");
-		cache.emission_img = _get_source_texture(state, material, "emission");
-		cache.normal_img = _get_source_texture(state, material, "normal");
-		cache.orm_img = _get_source_texture(state, material, "orm");
-		state.material_image_cache[material_cache_i] = cache;
+		_get_orm_sources(source_images, material, cache);
+		r_material_image_cache[material_cache_i] = cache;
 #ifdef TOOLS_ENABLED
-		progress_scene_merge.step(TTR("Getting Source Material: ") + material->get_name() + " (" + itos(step) + "/" + itos(state.material_cache.size()) + ")", step);
+		if (progress_scene_merge) {
+			progress_scene_merge->step(TTR("Getting Source Material: ") + material->get_name() + " (" + itos(step) + "/" + itos(p_material_cache.size()) + ")", step);
+		}
 #endif
 	}
-	_generate_texture_atlas(state, "albedo");
-	_generate_texture_atlas(state, "emission");
-	_generate_texture_atlas(state, "normal");
-	_generate_texture_atlas(state, "orm");
-	ERR_FAIL_COND_V(state.atlas->width <= 0 && state.atlas->height <= 0, state.p_root);
-	p_root = _output(state, p_index);
-
-	xatlas::Destroy(atlas);
-	return p_root;
+#ifdef TOOLS_ENABLED
+	if (progress_scene_merge) {
+		memdelete(progress_scene_merge);
+	}
+#endif
+	_end_stage(stage, p_material_cache.size());
 }
 
 void MeshMergeMaterialRepack::_mark_nodes(Node *p_current, Node *p_owner, Vector<Node *> &r_nodes) {
@@ -396,15 +1440,37 @@ void MeshMergeMaterialRepack::_clean_animation_player(Node *scene) {
 		if (!ap) {
 			continue;
 		}
-		List<StringName> animations;
-		ap->get_animation_list(&animations);
-		for (List<StringName>::Element *E = animations.front(); E; E = E->next()) {
-			Ref<Animation> animation = ap->get_animation(E->get());
-			for (int32_t k = 0; k < animation->get_track_count(); k++) {
-				NodePath path = animation->track_get_path(k);
-				if (!scene->has_node(path)) {
-					animation->remove_track(k);
+		// Libraries and their animations are resources that other scenes may share, so tracks are removed from copies.
+		List<StringName> libraries;
+		ap->get_animation_library_list(&libraries);
+		for (const StringName &library_name : libraries) {
+			Ref<AnimationLibrary> library = ap->get_animation_library(library_name);
+			Ref<AnimationLibrary> cleaned_library;
+			List<StringName> animations;
+			library->get_animation_list(&animations);
+			for (const StringName &animation_name : animations) {
+				Ref<Animation> animation = library->get_animation(animation_name);
+				Ref<Animation> cleaned_animation;
+				for (int32_t k = animation->get_track_count() - 1; k >= 0; k--) {
+					if (scene->has_node(animation->track_get_path(k))) {
+						continue;
+					}
+					if (cleaned_animation.is_null()) {
+						cleaned_animation = animation->duplicate();
+					}
+					cleaned_animation->remove_track(k);
 				}
+				if (cleaned_animation.is_null()) {
+					continue;
+				}
+				if (cleaned_library.is_null()) {
+					cleaned_library = library->duplicate();
+				}
+				cleaned_library->add_animation(animation_name, cleaned_animation);
+			}
+			if (cleaned_library.is_valid()) {
+				ap->remove_animation_library(library_name);
+				ap->add_animation_library(library_name, cleaned_library);
 			}
 		}
 	}
@@ -431,233 +1497,378 @@ void MeshMergeMaterialRepack::_remove_nodes(Node *scene, Vector<Node *> &r_nodes
 	}
 }
 
-void MeshMergeMaterialRepack::_generate_texture_atlas(MergeState &state, String texture_type) {
-	Ref<Image> atlas_img = Image::create_empty(state.atlas->width, state.atlas->height, false, Image::FORMAT_RGBA8);
-	// Rasterize chart triangles.
-#ifdef TOOLS_ENABLED
-	EditorProgress progress_texture_atlas("gen_mesh_atlas", TTR("Generate Atlas"), state.atlas->meshCount);
-	int step = 0;
-#endif
-	for (uint32_t mesh_i = 0; mesh_i < state.atlas->meshCount; mesh_i++) {
-		const xatlas::Mesh &mesh = state.atlas->meshes[mesh_i];
-		for (uint32_t chart_i = 0; chart_i < mesh.chartCount; chart_i++) {
-			const xatlas::Chart &chart = mesh.chartArray[chart_i];
-			Ref<Image> img;
-			if (texture_type == "albedo") {
-				img = state.material_image_cache[chart.material].albedo_img;
-			} else if (texture_type == "normal") {
-				img = state.material_image_cache[chart.material].normal_img;
-			} else if (texture_type == "orm") {
-				img = state.material_image_cache[chart.material].orm_img;
-			} else if (texture_type == "emission") {
-				img = state.material_image_cache[chart.material].emission_img;
-			}
-			if (img.is_null()) {
-				img = Image::create_empty(default_texture_length, default_texture_length, false, Image::FORMAT_RGBA8);
+static _FORCE_INLINE_ int32_t wrap_texel_coordinate(float p_uv, int32_t p_max) {
+	// Keep coordinates in range of texture dimensions.
+	if (p_max <= 0) {
+		return 0;
+	}
+	float coordinate = p_uv * p_max;
+	if (coordinate < 0) {
+		coordinate = Math::fposmod(coordinate, (float)p_max);
+	} else if ((int32_t)coordinate > p_max) {
+		coordinate = Math::fmod(coordinate, (float)p_max);
+	}
+	return CLAMP((int32_t)coordinate, 0, p_max);
+}
+
+void MeshMergeMaterialRepack::AtlasTexelSampler::set_material(const MaterialImageCache *p_cache) {
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		const Ref<Image> source_image = p_cache ? p_cache->images[texture_i] : Ref<Image>();
+		source_data[texture_i] = source_image.is_valid() ? source_image->ptr() : nullptr;
+		source_width[texture_i] = source_image.is_valid() ? source_image->get_width() : 0;
+		source_height[texture_i] = source_image.is_valid() ? source_image->get_height() : 0;
+	}
+	has_orm = p_cache && p_cache->has_orm;
+	for (int32_t channel_i = 0; channel_i < ORM_CHANNEL_MAX; channel_i++) {
+		const OrmChannelSource *orm = p_cache ? &p_cache->orm[channel_i] : nullptr;
+		const bool has_image = orm && orm->image.is_valid();
+		orm_data[channel_i] = has_image ? orm->image->ptr() : nullptr;
+		orm_width[channel_i] = has_image ? orm->image->get_width() : 0;
+		orm_height[channel_i] = has_image ? orm->image->get_height() : 0;
+		orm_channel[channel_i] = orm ? orm->channel : 0;
+		orm_multiplier[channel_i] = orm ? orm->multiplier : 0.0f;
+		orm_value[channel_i] = orm ? orm->value : 0;
+	}
+}
+
+_FORCE_INLINE_ void MeshMergeMaterialRepack::AtlasTexelSampler::write_texel(uint32_t p_atlas_offset, const Vector2 &p_source_uv) {
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		const uint8_t *source = source_data[texture_i];
+		if (!source) {
+			continue;
+		}
+		const int32_t sx = wrap_texel_coordinate(p_source_uv.x, source_width[texture_i] - 1);
+		const int32_t sy = wrap_texel_coordinate(p_source_uv.y, source_height[texture_i] - 1);
+		const uint8_t *texel = source + (sy * source_width[texture_i] + sx) * 4;
+		uint8_t *atlas_texel = atlas_data[texture_i] + p_atlas_offset * 4;
+		atlas_texel[0] = texel[0];
+		atlas_texel[1] = texel[1];
+		atlas_texel[2] = texel[2];
+		atlas_texel[3] = texel[3];
+	}
+	if (has_orm) {
+		uint8_t *atlas_texel = atlas_data[ATLAS_TEXTURE_ORM] + p_atlas_offset * 4;
+		for (int32_t channel_i = 0; channel_i < ORM_CHANNEL_MAX; channel_i++) {
+			const uint8_t *source = orm_data[channel_i];
+			if (!source) {
+				atlas_texel[channel_i] = orm_value[channel_i];
+				continue;
 			}
-			ERR_CONTINUE_MSG(Image::get_format_pixel_size(img->get_format()) > 4, "Float textures are not supported yet");
-			img->convert(Image::FORMAT_RGBA8);
-			SetAtlasTexelArgs args;
-			args.sourceTexture = img;
-			args.atlasData = atlas_img;
-			args.atlas_lookup = state.atlas_lookup.ptrw();
-			args.material_index = (uint16_t)chart.material;
-			for (uint32_t face_i = 0; face_i < chart.faceCount; face_i++) {
-				Vector2 v[3];
+			const int32_t sx = wrap_texel_coordinate(p_source_uv.x, orm_width[channel_i] - 1);
+			const int32_t sy = wrap_texel_coordinate(p_source_uv.y, orm_height[channel_i] - 1);
+			const float value = source[(sy * orm_width[channel_i] + sx) * 4 + orm_channel[channel_i]] * orm_multiplier[channel_i];
+			atlas_texel[channel_i] = (uint8_t)MIN(value, 255.0f);
+		}
+		atlas_texel[3] = 255;
+	}
+}
+
+static _FORCE_INLINE_ uint16_t encode_lookup_coordinate(float p_uv) {
+	if (p_uv < 0.0f || p_uv > 1.0f) {
+		p_uv = Math::fposmod(p_uv, 1.0f);
+	}
+	return (uint16_t)(p_uv * 65535.0f + 0.5f);
+}
+
+_FORCE_INLINE_ bool MeshMergeMaterialRepack::AtlasTexelSampler::operator()(int x, int y, const Vector3 &bar, const Vector3 &, const Vector3 &, float) {
+	// Interpolate source UVs using barycentrics.
+	const Vector2 sourceUv = source_uvs[0] * bar.x + source_uvs[1] * bar.y + source_uvs[2] * bar.z;
+	const uint32_t atlas_offset = y * atlas_width + x;
+	write_texel(atlas_offset, sourceUv);
+	AtlasLookupTexel &lookup = atlas_lookup[atlas_offset];
+	lookup.material_index = material_index;
+	lookup.u = encode_lookup_coordinate(sourceUv.x);
+	lookup.v = encode_lookup_coordinate(sourceUv.y);
+	return true;
+}
+
+void MeshMergeMaterialRepack::_generate_texture_atlas(MergeState &state) {
+	if (state.atlas->width == 0 || state.atlas->height == 0) {
+		return;
+	}
+	RasterizeAtlasJob job;
+	job.state = &state;
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		job.atlas_images[texture_i] = Image::create_empty(state.atlas->width, state.atlas->height, false, Image::FORMAT_RGBA8);
+		job.sampler.atlas_data[texture_i] = job.atlas_images[texture_i]->ptrw();
+	}
+	job.sampler.atlas_lookup = state.atlas_lookup.ptrw();
+	job.sampler.atlas_width = state.atlas->width;
+	const int32_t stage = _begin_stage("rasterize", state.group);
+	uint64_t triangle_count = 0;
+	// Charts do not overlap after packing, so the atlas is split into fixed bands of rows that are rasterized in parallel.
+	for (uint32_t mesh_i = 0; mesh_i < state.atlas->meshes.size(); mesh_i++) {
+		const AtlasMeshData &mesh = state.atlas->meshes[mesh_i];
+		for (uint32_t chart_i = 0; chart_i < mesh.charts.size(); chart_i++) {
+			const AtlasChartData &chart = mesh.charts[chart_i];
+			AtlasChartBounds bounds;
+			bounds.mesh_index = mesh_i;
+			bounds.chart_index = chart_i;
+			bounds.min_y = FLT_MAX;
+			bounds.max_y = -FLT_MAX;
+			for (uint32_t face_i = 0; face_i < chart.face_count; face_i++) {
 				for (uint32_t l = 0; l < 3; l++) {
-					const uint32_t index = mesh.indexArray[chart.faceArray[face_i] * 3 + l];
-					const xatlas::Vertex &vertex = mesh.vertexArray[index];
-					v[l] = Vector2(vertex.uv[0], vertex.uv[1]);
-					args.source_uvs[l].x = state.uvs[mesh_i][vertex.xref].x / img->get_width();
-					args.source_uvs[l].y = state.uvs[mesh_i][vertex.xref].y / img->get_height();
+					const uint32_t index = mesh.indices[mesh.chart_faces[chart.first_face + face_i] * 3 + l];
+					bounds.min_y = MIN(bounds.min_y, mesh.uvs[index].y);
+					bounds.max_y = MAX(bounds.max_y, mesh.uvs[index].y);
 				}
-				Triangle tri(v[0], v[1], v[2], Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1));
-
-				tri.drawAA(setAtlasTexel, &args);
+			}
+			if (chart.face_count) {
+				job.charts.push_back(bounds);
+				triangle_count += chart.face_count;
 			}
 		}
+	}
+	const int32_t band_count = (state.atlas->height + atlas_band_height - 1) / atlas_band_height;
+	// Rasterize chart triangles.
+	if (is_pool_thread()) {
+		for (int32_t band_i = 0; band_i < band_count; band_i++) {
+			_rasterize_atlas_band(band_i, &job);
+		}
+	} else {
+		WorkerThreadPool::GroupID group_task = WorkerThreadPool::get_singleton()->add_template_group_task(this, &MeshMergeMaterialRepack::_rasterize_atlas_band, &job, band_count, _get_thread_budget(), true, "Scene Merge Rasterize Atlas");
 #ifdef TOOLS_ENABLED
-		progress_texture_atlas.step(TTR("Process Mesh for Atlas: ") + texture_type + " (" + itos(step) + "/" + itos(state.atlas->meshCount) + ")", step);
-		step++;
+		if (can_show_editor_progress()) {
+			EditorProgress progress_texture_atlas("gen_mesh_atlas", TTR("Generate Atlas"), band_count);
+			while (!WorkerThreadPool::get_singleton()->is_group_task_completed(group_task)) {
+				int32_t step = WorkerThreadPool::get_singleton()->get_group_processed_element_count(group_task);
+				progress_texture_atlas.step(TTR("Process Mesh for Atlas") + " (" + itos(step) + "/" + itos(band_count) + ")", step);
+				OS::get_singleton()->delay_usec(10000);
+			}
+		}
 #endif
+		WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group_task);
+	}
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		job.atlas_images[texture_i]->generate_mipmaps();
+		state.texture_atlas[texture_i] = job.atlas_images[texture_i];
 	}
-	atlas_img->generate_mipmaps();
-	state.texture_atlas.insert(texture_type, atlas_img);
+	_end_stage(stage, triangle_count);
 }
 
-Ref<Image> MeshMergeMaterialRepack::_get_source_texture(MergeState &state, Ref<BaseMaterial3D> material, String texture_type) {
+void MeshMergeMaterialRepack::_rasterize_atlas_band(uint32_t p_band, RasterizeAtlasJob *p_job) {
+	const MergeState &state = *p_job->state;
+	const int32_t band_y = p_band * atlas_band_height;
+	const Rect2i clip(0, band_y, state.atlas->width, MIN(atlas_band_height, (int32_t)state.atlas->height - band_y));
+	// Partially covered texels reach up to one texel outside the triangle bounds.
+	const float band_min_y = clip.position.y - 2.0f;
+	const float band_max_y = clip.get_end().y + 2.0f;
+	AtlasTexelSampler sampler = p_job->sampler;
+	for (const AtlasChartBounds &bounds : p_job->charts) {
+		if (bounds.max_y < band_min_y || bounds.min_y > band_max_y) {
+			continue;
+		}
+		const AtlasMeshData &mesh = state.atlas->meshes[bounds.mesh_index];
+		const AtlasChartData &chart = mesh.charts[bounds.chart_index];
+		sampler.set_material(state.material_image_cache.getptr(chart.material));
+		sampler.material_index = (uint16_t)chart.material;
+		const Vector<ModelVertex> &source_vertices = state.model_vertices[bounds.mesh_index];
+		for (uint32_t face_i = 0; face_i < chart.face_count; face_i++) {
+			Vector2 v[3];
+			for (uint32_t l = 0; l < 3; l++) {
+				const uint32_t index = mesh.indices[mesh.chart_faces[chart.first_face + face_i] * 3 + l];
+				v[l] = mesh.uvs[index];
+				sampler.source_uvs[l] = source_vertices[mesh.xrefs[index]].uv;
+			}
+			if (MAX(v[0].y, MAX(v[1].y, v[2].y)) < band_min_y || MIN(v[0].y, MIN(v[1].y, v[2].y)) > band_max_y) {
+				continue;
+			}
+			Triangle tri(v[0], v[1], v[2], Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1));
+
+			tri.drawAA(sampler, clip);
+		}
+	}
+}
+
+void MeshMergeMaterialRepack::_gather_atlas_band(uint32_t p_band, GatherAtlasJob *p_job) {
+	const uint32_t row_begin = p_band * atlas_band_height;
+	const uint32_t row_end = MIN(row_begin + atlas_band_height, p_job->height);
+	AtlasTexelSampler sampler = p_job->sampler;
+	int32_t bound_material = -1;
+	for (uint32_t offset = row_begin * p_job->width; offset < row_end * p_job->width; offset++) {
+		const AtlasLookupTexel &lookup = p_job->lookup[offset];
+		if (lookup.material_index == 0) {
+			continue;
+		}
+		if (lookup.material_index != bound_material) {
+			sampler.set_material(p_job->material_image_cache->getptr(lookup.material_index));
+			bound_material = lookup.material_index;
+		}
+		sampler.write_texel(offset, Vector2(lookup.u, lookup.v) / 65535.0f);
+	}
+}
+
+// Per-pixel material kernels over RGBA8 rows. Rows are split into blocks that run on the WorkerThreadPool.
+struct ImageKernelJob {
+	const uint8_t *sources[3] = {};
+	uint8_t channel[3] = {};
+	float multiplier[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	float addend[4] = {};
+	uint8_t *destination = nullptr;
 	int32_t width = 0;
 	int32_t height = 0;
-	if (material.is_null()) {
-		return Ref<Image>();
-	}
-	Ref<Texture2D> ao_texture = material->get_texture(BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION);
-	Ref<Image> ao_img;
-	if (ao_texture.is_valid()) {
-		ao_img = ao_texture->get_image();
-	}
-	Ref<Texture2D> metallic_texture = material->get_texture(BaseMaterial3D::TEXTURE_METALLIC);
-	Ref<Image> metallic_img;
-	if (metallic_texture.is_valid()) {
-		metallic_img = metallic_texture->get_image();
-	}
-	Ref<Texture2D> roughness_texture = material->get_texture(BaseMaterial3D::TEXTURE_ROUGHNESS);
-	Ref<Image> roughness_img;
-	if (roughness_texture.is_valid()) {
-		roughness_img = roughness_texture->get_image();
-	}
-	Ref<Texture2D> albedo_texture = material->get_texture(BaseMaterial3D::TEXTURE_ALBEDO);
-	Ref<Image> albedo_img;
-	if (albedo_texture.is_valid()) {
-		albedo_img = albedo_texture->get_image();
-	}
-	Ref<Texture2D> normal_texture = material->get_texture(BaseMaterial3D::TEXTURE_NORMAL);
-	Ref<Image> normal_img;
-	if (normal_texture.is_valid()) {
-		normal_img = normal_texture->get_image();
-	}
-	Ref<Texture2D> emission_texture = material->get_texture(BaseMaterial3D::TEXTURE_EMISSION);
-	Ref<Image> emission_img;
-	if (emission_texture.is_valid()) {
-		emission_img = emission_texture->get_image();
-	}
-	if (albedo_img.is_valid() && !albedo_img->is_empty()) {
-		width = MAX(width, albedo_img->get_width());
-		height = MAX(height, albedo_img->get_height());
-	}
-	if (emission_texture.is_valid() && !emission_img->is_empty()) {
-		width = MAX(width, emission_img->get_width());
-		height = MAX(height, emission_img->get_height());
-	}
-	if (ao_img.is_valid() && !ao_img->is_empty()) {
-		width = MAX(width, ao_img->get_width());
-		height = MAX(height, ao_img->get_height());
-	}
-	if (metallic_img.is_valid() && !metallic_img->is_empty()) {
-		width = MAX(width, metallic_img->get_width());
-		height = MAX(height, metallic_img->get_height());
-	}
-	if (roughness_img.is_valid() && !roughness_img->is_empty()) {
-		width = MAX(width, roughness_img->get_width());
-		height = MAX(height, roughness_img->get_height());
-	}
-	if (normal_img.is_valid() && !normal_img->is_empty()) {
-		width = MAX(width, normal_img->get_width());
-		height = MAX(height, normal_img->get_height());
-	}
-	if (albedo_img.is_valid()) {
-		if (!albedo_img->is_empty()) {
-			if (albedo_img->is_compressed()) {
-				albedo_img->decompress();
-			}
+};
+
+static const int32_t image_kernel_block_rows = 64;
+
+// destination = source * multiplier + addend per channel, saturated like Image::set_pixel.
+static void _tint_image_rows(void *p_userdata, uint32_t p_block) {
+	const ImageKernelJob &job = *(const ImageKernelJob *)p_userdata;
+	const int32_t row_begin = p_block * image_kernel_block_rows;
+	const int32_t row_end = MIN(row_begin + image_kernel_block_rows, job.height);
+	const int64_t begin = int64_t(row_begin) * job.width;
+	const int64_t end = int64_t(row_end) * job.width;
+	const uint8_t *src = job.sources[0];
+	uint8_t *dst = job.destination;
+	int64_t pixel_i = begin;
+#if defined(SCENE_MERGE_SIMD_AVX2) || defined(SCENE_MERGE_SIMD_SSE2)
+	const __m128 multiplier = _mm_loadu_ps(job.multiplier);
+	const __m128 addend = _mm_loadu_ps(job.addend);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 max_value = _mm_set1_ps(255.0f);
+	for (; pixel_i + 4 <= end; pixel_i += 4) {
+		const __m128i pixels = _mm_loadu_si128((const __m128i *)(src + pixel_i * 4));
+		const __m128i low = _mm_unpacklo_epi8(pixels, zero);
+		const __m128i high = _mm_unpackhi_epi8(pixels, zero);
+		__m128i result[4] = {
+			_mm_unpacklo_epi16(low, zero),
+			_mm_unpackhi_epi16(low, zero),
+			_mm_unpacklo_epi16(high, zero),
+			_mm_unpackhi_epi16(high, zero),
+		};
+		for (int32_t i = 0; i < 4; i++) {
+			const __m128 value = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(result[i]), multiplier), addend);
+			result[i] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), max_value));
 		}
-		albedo_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
+		const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(result[0], result[1]), _mm_packs_epi32(result[2], result[3]));
+		_mm_storeu_si128((__m128i *)(dst + pixel_i * 4), packed);
 	}
-	if (ao_img.is_valid()) {
-		if (!ao_img->is_empty()) {
-			if (ao_img->is_compressed()) {
-				ao_img->decompress();
-			}
+#endif
+	for (; pixel_i < end; pixel_i++) {
+		for (int32_t c = 0; c < 4; c++) {
+			const float value = src[pixel_i * 4 + c] * job.multiplier[c] + job.addend[c];
+			dst[pixel_i * 4 + c] = (uint8_t)CLAMP(value, 0.0f, 255.0f);
 		}
-		ao_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
 	}
-	if (roughness_img.is_valid()) {
-		if (!roughness_img->is_empty()) {
-			if (roughness_img->is_compressed()) {
-				roughness_img->decompress();
-			}
+}
+
+// Packs occlusion, roughness and metallic from the selected byte of three same-sized maps, scaled by the
+// material multipliers, into RGB with an opaque alpha.
+static void _pack_orm_image_rows(void *p_userdata, uint32_t p_block) {
+	const ImageKernelJob &job = *(const ImageKernelJob *)p_userdata;
+	const int32_t row_begin = p_block * image_kernel_block_rows;
+	const int32_t row_end = MIN(row_begin + image_kernel_block_rows, job.height);
+	const int64_t begin = int64_t(row_begin) * job.width;
+	const int64_t end = int64_t(row_end) * job.width;
+	uint32_t *dst = (uint32_t *)job.destination;
+	int64_t pixel_i = begin;
+#if defined(SCENE_MERGE_SIMD_AVX2) || defined(SCENE_MERGE_SIMD_SSE2)
+	const __m128i byte_mask = _mm_set1_epi32(0xff);
+	const __m128i alpha = _mm_set1_epi32(int32_t(0xff000000));
+	__m128i shift[3];
+	__m128i channel_shift[3];
+	__m128 multiplier[3];
+	for (int32_t c = 0; c < 3; c++) {
+		shift[c] = _mm_cvtsi32_si128(job.channel[c] * 8);
+		channel_shift[c] = _mm_cvtsi32_si128(c * 8);
+		multiplier[c] = _mm_set1_ps(job.multiplier[c]);
+	}
+	const __m128 max_value = _mm_set1_ps(255.0f);
+	for (; pixel_i + 4 <= end; pixel_i += 4) {
+		__m128i packed = alpha;
+		for (int32_t c = 0; c < 3; c++) {
+			const __m128i pixels = _mm_loadu_si128((const __m128i *)(job.sources[c] + pixel_i * 4));
+			const __m128i value = _mm_and_si128(_mm_srl_epi32(pixels, shift[c]), byte_mask);
+			const __m128 scaled = _mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(value), multiplier[c]), max_value);
+			packed = _mm_or_si128(packed, _mm_sll_epi32(_mm_cvttps_epi32(scaled), channel_shift[c]));
 		}
-		roughness_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
+		_mm_storeu_si128((__m128i *)(dst + pixel_i), packed);
 	}
-	if (metallic_img.is_valid()) {
-		if (!metallic_img->is_empty()) {
-			if (metallic_img->is_compressed()) {
-				metallic_img->decompress();
-			}
+#endif
+	for (; pixel_i < end; pixel_i++) {
+		uint32_t packed = 0xff000000;
+		for (int32_t c = 0; c < 3; c++) {
+			const float value = job.sources[c][pixel_i * 4 + job.channel[c]] * job.multiplier[c];
+			packed |= uint32_t((uint8_t)MIN(value, 255.0f)) << (c * 8);
 		}
-		metallic_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
+		dst[pixel_i] = packed;
 	}
-	if (normal_img.is_valid()) {
-		if (!normal_img->is_empty()) {
-			if (normal_img->is_compressed()) {
-				normal_img->decompress();
-			}
+}
+
+static void _run_image_kernel(ImageKernelJob &p_job, void (*p_kernel)(void *, uint32_t), int32_t p_tasks) {
+	const int32_t block_count = (p_job.height + image_kernel_block_rows - 1) / image_kernel_block_rows;
+	if (block_count <= 1 || is_pool_thread()) {
+		for (int32_t block_i = 0; block_i < block_count; block_i++) {
+			p_kernel(&p_job, block_i);
 		}
-		normal_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
+		return;
 	}
-	if (emission_img.is_valid()) {
-		if (!emission_img->is_empty()) {
-			if (emission_img->is_compressed()) {
-				emission_img->decompress();
-			}
+	WorkerThreadPool::GroupID group_task = WorkerThreadPool::get_singleton()->add_native_group_task(p_kernel, &p_job, block_count, p_tasks, true, "Scene Merge Material Kernel");
+	WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group_task);
+}
+
+MeshMergeMaterialRepack::MaterialSourceImages MeshMergeMaterialRepack::_decode_source_images(Ref<BaseMaterial3D> material) {
+	static const BaseMaterial3D::TextureParam source_textures[] = {
+		BaseMaterial3D::TEXTURE_ALBEDO,
+		BaseMaterial3D::TEXTURE_EMISSION,
+		BaseMaterial3D::TEXTURE_NORMAL,
+		BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION,
+		BaseMaterial3D::TEXTURE_ROUGHNESS,
+		BaseMaterial3D::TEXTURE_METALLIC,
+	};
+	MaterialSourceImages source_images;
+	if (material.is_null()) {
+		return source_images;
+	}
+	for (const BaseMaterial3D::TextureParam param : source_textures) {
+		Ref<Texture2D> texture = material->get_texture(param);
+		if (texture.is_null()) {
+			continue;
 		}
-		emission_img->resize(width, height, Image::INTERPOLATE_LANCZOS);
-	}
-	Ref<Image> img = Image::create_empty(width, height, false, Image::FORMAT_RGBA8);
-	Ref<Texture2D> tex;
-	if (texture_type == "orm") {
-		tex = Image::create_empty(width, height, false, Image::FORMAT_RGB8);
-		for (int32_t y = 0; y < img->get_height(); y++) {
-			for (int32_t x = 0; x < img->get_width(); x++) {
-				Color orm;
-				if (ao_img.is_valid() && !ao_img->is_empty()) {
-					if (material->get_ao_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_RED) {
-						orm.r = ao_img->get_pixel(x, y).r;
-					} else if (material->get_ao_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GREEN) {
-						orm.r = ao_img->get_pixel(x, y).g;
-					} else if (material->get_ao_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_BLUE) {
-						orm.r = ao_img->get_pixel(x, y).b;
-					} else if (material->get_ao_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_ALPHA) {
-						orm.r = ao_img->get_pixel(x, y).a;
-					} else if (material->get_ao_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GRAYSCALE) {
-						orm.r = ao_img->get_pixel(x, y).r;
-					}
-				}
-				float channel_mul = 0.0f;
-				if (roughness_img.is_valid() && !roughness_img->is_empty()) {
-					if (material->get_roughness_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_RED) {
-						orm.g = roughness_img->get_pixel(x, y).r;
-					} else if (material->get_roughness_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GREEN) {
-						orm.g = roughness_img->get_pixel(x, y).g;
-					} else if (material->get_roughness_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_BLUE) {
-						orm.g = roughness_img->get_pixel(x, y).b;
-					} else if (material->get_roughness_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_ALPHA) {
-						orm.g = roughness_img->get_pixel(x, y).a;
-					} else if (material->get_roughness_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GRAYSCALE) {
-						orm.g = roughness_img->get_pixel(x, y).r;
-					}
-				}
-				if (roughness_img.is_valid()) {
-					channel_mul = material->get_roughness();
-					orm.g = orm.g * channel_mul;
-				} else {
-					orm.g = material->get_roughness();
-				}
-				if (metallic_img.is_valid() && !metallic_img->is_empty()) {
-					if (material->get_metallic_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_RED) {
-						orm.b = metallic_img->get_pixel(x, y).r;
-					} else if (material->get_metallic_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GREEN) {
-						orm.b = metallic_img->get_pixel(x, y).g;
-					} else if (material->get_metallic_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_BLUE) {
-						orm.b = metallic_img->get_pixel(x, y).b;
-					} else if (material->get_metallic_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_ALPHA) {
-						orm.b = metallic_img->get_pixel(x, y).a;
-					} else if (material->get_metallic_texture_channel() == BaseMaterial3D::TEXTURE_CHANNEL_GRAYSCALE) {
-						orm.b = metallic_img->get_pixel(x, y).r;
-					}
-				}
-				if (metallic_img.is_valid()) {
-					channel_mul = material->get_metallic();
-					orm.b = orm.b * channel_mul;
-				} else {
-					orm.b = material->get_metallic();
-				}
-				img->set_pixel(x, y, orm);
-			}
+		Ref<Image> img = texture->get_image();
+		if (img.is_null() || img->is_empty()) {
+			continue;
 		}
-	} else if (texture_type == "albedo") {
-		Color color_mul;
-		Color color_add;
+		if (img->is_compressed()) {
+			img->decompress();
+		}
+		ERR_CONTINUE_MSG(Image::get_format_pixel_size(img->get_format()) > 4, "Float textures are not supported yet");
+		// Only the base level is sampled.
+		img->clear_mipmaps();
+		img->convert(Image::FORMAT_RGBA8);
+		source_images.images[param] = img;
+	}
+	return source_images;
+}
+
+Ref<Image> MeshMergeMaterialRepack::_get_source_texture(const MaterialSourceImages &p_source_images, Ref<BaseMaterial3D> material, AtlasTextureType texture_type) {
+	if (material.is_null()) {
+		return Ref<Image>();
+	}
+	const Ref<Image> &albedo_img = p_source_images.images[BaseMaterial3D::TEXTURE_ALBEDO];
+	const Ref<Image> &emission_img = p_source_images.images[BaseMaterial3D::TEXTURE_EMISSION];
+	const Ref<Image> &normal_img = p_source_images.images[BaseMaterial3D::TEXTURE_NORMAL];
+	if (texture_type == ATLAS_TEXTURE_NORMAL) {
+		if (normal_img.is_valid() && material->get_feature(BaseMaterial3D::FEATURE_NORMAL_MAPPING)) {
+			return normal_img;
+		}
+		// Without normal mapping the material contributes a flat tangent-space normal.
+		Ref<Image> img = Image::create_empty(1, 1, false, Image::FORMAT_RGBA8);
+		img->set_pixel(0, 0, Color(0.5f, 0.5f, 1.0f));
+		return img;
+	}
+	// Each layer keeps the resolution of the one map it is derived from; a constant color needs a single texel.
+	Ref<Image> source_img;
+	if (texture_type == ATLAS_TEXTURE_ALBEDO) {
+		source_img = albedo_img;
+	} else if (texture_type == ATLAS_TEXTURE_EMISSION) {
+		source_img = emission_img;
+	} else {
+		return Ref<Image>();
+	}
+	Color color_mul;
+	Color color_add;
+	if (texture_type == ATLAS_TEXTURE_ALBEDO) {
 		if (albedo_img.is_valid()) {
 			color_mul = material->get_albedo();
 			color_add = Color(0, 0, 0, 0);
@@ -665,206 +1876,381 @@ Ref<Image> MeshMergeMaterialRepack::_get_source_texture(MergeState &state, Ref<B
 			color_mul = Color(0, 0, 0, 0);
 			color_add = material->get_albedo();
 		}
-		for (int32_t y = 0; y < img->get_height(); y++) {
-			for (int32_t x = 0; x < img->get_width(); x++) {
-				Color c;
-				if (albedo_img.is_valid()) {
-					c = albedo_img->get_pixel(x, y);
-				}
-				c.r = c.r * color_mul.r + color_add.r;
-				c.g = c.g * color_mul.g + color_add.g;
-				c.b = c.b * color_mul.b + color_add.b;
-				c.a = c.a * color_mul.a + color_add.a;
-				img->set_pixel(x, y, c);
-			}
+	} else {
+		Color emission_col = material->get_emission();
+		float emission_energy = material->get_emission_energy_multiplier();
+		if (material->get_emission_operator() == BaseMaterial3D::EMISSION_OP_ADD) {
+			color_mul = Color(1, 1, 1) * emission_energy;
+			color_add = emission_col * emission_energy;
+		} else {
+			color_mul = emission_col * emission_energy;
+			color_add = Color(0, 0, 0);
+		}
+		// Emission keeps the alpha of its map.
+		color_mul.a = 1.0f;
+		color_add.a = 0.0f;
+	}
+	if (source_img.is_null()) {
+		Ref<Image> img = Image::create_empty(1, 1, false, Image::FORMAT_RGBA8);
+		const Color c = Color(0, 0, 0, 1) * color_mul + color_add;
+		img->set_pixel(0, 0, c);
+		return img;
+	}
+	Ref<Image> img = Image::create_empty(source_img->get_width(), source_img->get_height(), false, Image::FORMAT_RGBA8);
+	ImageKernelJob job;
+	job.sources[0] = source_img->ptr();
+	job.destination = img->ptrw();
+	job.width = img->get_width();
+	job.height = img->get_height();
+	job.multiplier[0] = color_mul.r;
+	job.multiplier[1] = color_mul.g;
+	job.multiplier[2] = color_mul.b;
+	job.multiplier[3] = color_mul.a;
+	job.addend[0] = color_add.r * 255.0f;
+	job.addend[1] = color_add.g * 255.0f;
+	job.addend[2] = color_add.b * 255.0f;
+	job.addend[3] = color_add.a * 255.0f;
+	_run_image_kernel(job, _tint_image_rows, _get_thread_budget());
+	return img;
+}
+
+void MeshMergeMaterialRepack::_get_orm_sources(const MaterialSourceImages &p_source_images, Ref<BaseMaterial3D> material, MaterialImageCache &r_cache) {
+	if (material.is_null()) {
+		return;
+	}
+	struct {
+		BaseMaterial3D::TextureParam param;
+		BaseMaterial3D::TextureChannel channel;
+		bool apply_multiplier;
+		float multiplier;
+	} channels[ORM_CHANNEL_MAX] = {
+		{ BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION, material->get_ao_texture_channel(), false, 1.0f },
+		{ BaseMaterial3D::TEXTURE_ROUGHNESS, material->get_roughness_texture_channel(), true, material->get_roughness() },
+		{ BaseMaterial3D::TEXTURE_METALLIC, material->get_metallic_texture_channel(), true, material->get_metallic() },
+	};
+	for (int32_t channel_i = 0; channel_i < ORM_CHANNEL_MAX; channel_i++) {
+		OrmChannelSource &orm = r_cache.orm[channel_i];
+		orm.image = p_source_images.images[channels[channel_i].param];
+		// Grayscale maps are read from their red channel.
+		orm.channel = channels[channel_i].channel == BaseMaterial3D::TEXTURE_CHANNEL_GRAYSCALE ? 0 : (uint8_t)channels[channel_i].channel;
+		orm.multiplier = channels[channel_i].apply_multiplier ? channels[channel_i].multiplier : 1.0f;
+		// Without a map the channel is the material's scalar value, and occlusion is none.
+		orm.value = channels[channel_i].apply_multiplier ? (uint8_t)CLAMP(channels[channel_i].multiplier * 255.0f, 0.0f, 255.0f) : 255;
+	}
+	r_cache.has_orm = true;
+	// Maps of the same size, usually one packed texture referenced three times, are swizzled into a single ORM image
+	// up front so the rasterizer only fetches one texel.
+	const Ref<Image> &first = r_cache.orm[ORM_CHANNEL_OCCLUSION].image;
+	for (int32_t channel_i = 0; channel_i < ORM_CHANNEL_MAX; channel_i++) {
+		const Ref<Image> &img = r_cache.orm[channel_i].image;
+		if (img.is_null() || first.is_null() || img->get_width() != first->get_width() || img->get_height() != first->get_height()) {
+			return;
+		}
+	}
+	Ref<Image> img = Image::create_empty(first->get_width(), first->get_height(), false, Image::FORMAT_RGBA8);
+	ImageKernelJob job;
+	job.destination = img->ptrw();
+	job.width = img->get_width();
+	job.height = img->get_height();
+	for (int32_t channel_i = 0; channel_i < ORM_CHANNEL_MAX; channel_i++) {
+		job.sources[channel_i] = r_cache.orm[channel_i].image->ptr();
+		job.channel[channel_i] = r_cache.orm[channel_i].channel;
+		job.multiplier[channel_i] = r_cache.orm[channel_i].multiplier;
+	}
+	_run_image_kernel(job, _pack_orm_image_rows, _get_thread_budget());
+	r_cache.images[ATLAS_TEXTURE_ORM] = img;
+	r_cache.has_orm = false;
+}
+
+void MeshMergeMaterialRepack::_generate_atlas(const Vector<Vector<Vector2> > &p_uvs, const Vector<MeshState> &p_meshes, const LocalVector<SurfaceSnapshot> &p_surfaces,
+		const xatlas::PackOptions &p_pack_options, int32_t p_group, AtlasResult &r_atlas) {
+	xatlas::Atlas *atlas = xatlas::Create();
+	// Per-face material table handed to xatlas. AddUvMesh copies it, so one buffer serves every surface.
+	LocalVector<uint32_t> materials;
+	for (int32_t mesh_i = 0; mesh_i < p_meshes.size(); mesh_i++) {
+		const SurfaceSnapshot &surface = p_surfaces[p_meshes[mesh_i].surface_id];
+		if (surface.indices.is_empty() || p_uvs[mesh_i].is_empty()) {
+			xatlas::UvMeshDecl meshDecl;
+			xatlas::AddUvMesh(atlas, meshDecl);
+			continue;
+		}
+		materials.resize(surface.indices.size() / 3);
+		for (uint32_t face_i = 0; face_i < materials.size(); face_i++) {
+			materials[face_i] = surface.material_id;
 		}
-	} else if (texture_type == "normal") {
-		if (normal_img.is_valid()) {
-			img = normal_img;
+		xatlas::UvMeshDecl meshDecl;
+		meshDecl.vertexCount = p_uvs[mesh_i].size();
+		meshDecl.vertexUvData = p_uvs[mesh_i].ptr();
+		meshDecl.vertexStride = sizeof(Vector2);
+		meshDecl.indexCount = surface.indices.size();
+		meshDecl.indexData = surface.indices.ptr();
+		meshDecl.indexFormat = xatlas::IndexFormat::UInt32;
+		meshDecl.faceMaterialData = materials.ptr();
+		xatlas::AddMeshError error = xatlas::AddUvMesh(atlas, meshDecl);
+		ERR_CONTINUE_MSG(error != xatlas::AddMeshError::Success, String("Error adding mesh ") + itos(mesh_i) + String(": ") + xatlas::StringForEnum(error));
+	}
+	int32_t stage = _begin_stage("compute_charts", p_group);
+	xatlas::ComputeCharts(atlas);
+	_end_stage(stage, atlas->chartCount);
+	stage = _begin_stage("pack_charts", p_group);
+	xatlas::PackCharts(atlas, p_pack_options);
+	_end_stage(stage, uint64_t(atlas->width) * atlas->height);
+
+	r_atlas.width = atlas->width;
+	r_atlas.height = atlas->height;
+	r_atlas.meshes.resize(atlas->meshCount);
+	for (uint32_t mesh_i = 0; mesh_i < atlas->meshCount; mesh_i++) {
+		const xatlas::Mesh &mesh = atlas->meshes[mesh_i];
+		AtlasMeshData &mesh_data = r_atlas.meshes[mesh_i];
+		mesh_data.uvs.resize(mesh.vertexCount);
+		mesh_data.xrefs.resize(mesh.vertexCount);
+		for (uint32_t vertex_i = 0; vertex_i < mesh.vertexCount; vertex_i++) {
+			mesh_data.uvs[vertex_i] = Vector2(mesh.vertexArray[vertex_i].uv[0], mesh.vertexArray[vertex_i].uv[1]);
+			mesh_data.xrefs[vertex_i] = mesh.vertexArray[vertex_i].xref;
 		}
-	} else if (texture_type == "emission") {
-		Color emission_col = material->get_emission();
-		float emission_energy = material->get_emission_energy_multiplier();
-		Color color_mul;
-		Color color_add;
-		if (material->get_emission_operator() == BaseMaterial3D::EMISSION_OP_ADD) {
-			color_mul = Color(1, 1, 1) * emission_energy;
-			color_add = emission_col * emission_energy;
-		} else {
-			color_mul = emission_col * emission_energy;
-			color_add = Color(0, 0, 0);
+		mesh_data.indices.resize(mesh.indexCount);
+		if (mesh.indexCount) {
+			memcpy(mesh_data.indices.ptr(), mesh.indexArray, sizeof(uint32_t) * mesh.indexCount);
 		}
-		for (int32_t y = 0; y < img->get_height(); y++) {
-			for (int32_t x = 0; x < img->get_width(); x++) {
-				Color c;
-				if (emission_img.is_valid()) {
-					c = emission_img->get_pixel(x, y);
-				}
-				c.r = c.r * color_mul.r + color_add.r;
-				c.g = c.g * color_mul.g + color_add.g;
-				c.b = c.b * color_mul.b + color_add.b;
-				img->set_pixel(x, y, c);
+		mesh_data.charts.resize(mesh.chartCount);
+		for (uint32_t chart_i = 0; chart_i < mesh.chartCount; chart_i++) {
+			const xatlas::Chart &chart = mesh.chartArray[chart_i];
+			AtlasChartData &chart_data = mesh_data.charts[chart_i];
+			chart_data.material = chart.material;
+			chart_data.first_face = mesh_data.chart_faces.size();
+			chart_data.face_count = chart.faceCount;
+			for (uint32_t face_i = 0; face_i < chart.faceCount; face_i++) {
+				mesh_data.chart_faces.push_back(chart.faceArray[face_i]);
 			}
 		}
 	}
-	return img;
+	xatlas::Destroy(atlas);
 }
 
-void MeshMergeMaterialRepack::_generate_atlas(const int32_t p_num_meshes, Vector<Vector<Vector2> > &r_uvs, xatlas::Atlas *atlas, const Vector<MeshState> &r_meshes, const Vector<Ref<Material> > material_cache,
-		xatlas::PackOptions &pack_options) {
-	uint32_t mesh_count = 0;
-	for (int32_t mesh_i = 0; mesh_i < r_meshes.size(); mesh_i++) {
-		for (int32_t j = 0; j < r_meshes[mesh_i].mesh->get_surface_count(); j++) {
-			Array mesh = r_meshes[mesh_i].mesh->surface_get_arrays(j);
-			if (mesh.is_empty()) {
-				xatlas::UvMeshDecl meshDecl;
-				xatlas::AddUvMesh(atlas, meshDecl);
-				mesh_count++;
-				continue;
-			}
-			Array indices = mesh[ArrayMesh::ARRAY_INDEX];
-			if (!indices.size()) {
-				xatlas::UvMeshDecl meshDecl;
-				xatlas::AddUvMesh(atlas, meshDecl);
-				mesh_count++;
-				continue;
-			}
-			xatlas::UvMeshDecl meshDecl;
-			meshDecl.vertexCount = r_uvs[mesh_count].size();
-			meshDecl.vertexUvData = r_uvs[mesh_count].ptr();
-			meshDecl.vertexStride = sizeof(Vector2);
-			Vector<int32_t> mesh_indices = mesh[Mesh::ARRAY_INDEX];
-			Vector<uint32_t> indexes;
-			indexes.resize(mesh_indices.size());
-			Vector<uint32_t> materials;
-			materials.resize(mesh_indices.size());
-			for (int32_t index_i = 0; index_i < mesh_indices.size(); index_i++) {
-				indexes.write[index_i] = mesh_indices[index_i];
-			}
-			for (int32_t index_i = 0; index_i < mesh_indices.size(); index_i++) {
-				Ref<Material> mat = r_meshes[mesh_i].mesh->surface_get_material(j);
-				int32_t material_i = material_cache.find(mat);
-				if (material_i != -1) {
-					materials.write[index_i] = material_i;
-				}
-			}
-			meshDecl.indexCount = indexes.size();
-			meshDecl.indexData = indexes.ptr();
-			meshDecl.indexFormat = xatlas::IndexFormat::UInt32;
-			meshDecl.faceMaterialData = materials.ptr();
-			xatlas::AddMeshError error = xatlas::AddUvMesh(atlas, meshDecl);
-			ERR_CONTINUE_MSG(error != xatlas::AddMeshError::Success, String("Error adding mesh ") + itos(mesh_i) + String(": ") + xatlas::StringForEnum(error));
-			mesh_count++;
+String MeshMergeMaterialRepack::_hash_atlas_input(const Vector<Vector<Vector2> > &p_uvs, const Vector<MeshState> &p_meshes, const LocalVector<SurfaceSnapshot> &p_surfaces, const xatlas::PackOptions &p_pack_options) {
+	CryptoCore::SHA256Context context;
+	context.start();
+	hash_data(context, &merge_cache_version, sizeof(merge_cache_version));
+	hash_pack_options(context, p_pack_options);
+	for (int32_t mesh_i = 0; mesh_i < p_meshes.size(); mesh_i++) {
+		const SurfaceSnapshot &surface = p_surfaces[p_meshes[mesh_i].surface_id];
+		const uint32_t counts[3] = { (uint32_t)p_uvs[mesh_i].size(), surface.indices.size(), (uint32_t)surface.material_id };
+		hash_data(context, counts, sizeof(counts));
+		hash_data(context, p_uvs[mesh_i].ptr(), sizeof(Vector2) * p_uvs[mesh_i].size());
+		hash_data(context, surface.indices.ptr(), sizeof(uint32_t) * surface.indices.size());
+	}
+	unsigned char hash[32];
+	context.finish(hash);
+	return String::hex_encode_buffer(hash, 32);
+}
+
+// Sidecar layout: magic, version, sizeof(real_t), width, height and mesh count, then per mesh the vertex, index,
+// chart and chart face counts followed by the raw uvs, xrefs, indices, charts and chart faces.
+static const uint32_t atlas_sidecar_magic = 0x54414d53; // "SMAT"
+static const uint32_t atlas_sidecar_version = 1;
+
+Error MeshMergeMaterialRepack::_save_atlas(const String &p_path, const AtlasResult &p_atlas) {
+	Error err = OK;
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V_MSG(file.is_null(), err, "Cannot write scene merge atlas to " + p_path + ".");
+	file->store_32(atlas_sidecar_magic);
+	file->store_32(atlas_sidecar_version);
+	file->store_32(sizeof(real_t));
+	file->store_32(p_atlas.width);
+	file->store_32(p_atlas.height);
+	file->store_32(p_atlas.meshes.size());
+	for (const AtlasMeshData &mesh : p_atlas.meshes) {
+		file->store_32(mesh.uvs.size());
+		file->store_32(mesh.indices.size());
+		file->store_32(mesh.charts.size());
+		file->store_32(mesh.chart_faces.size());
+		file->store_buffer((const uint8_t *)mesh.uvs.ptr(), sizeof(Vector2) * mesh.uvs.size());
+		file->store_buffer((const uint8_t *)mesh.xrefs.ptr(), sizeof(uint32_t) * mesh.xrefs.size());
+		file->store_buffer((const uint8_t *)mesh.indices.ptr(), sizeof(uint32_t) * mesh.indices.size());
+		file->store_buffer((const uint8_t *)mesh.charts.ptr(), sizeof(AtlasChartData) * mesh.charts.size());
+		file->store_buffer((const uint8_t *)mesh.chart_faces.ptr(), sizeof(uint32_t) * mesh.chart_faces.size());
+	}
+	return file->get_error() == OK ? OK : ERR_FILE_CANT_WRITE;
+}
+
+Error MeshMergeMaterialRepack::_load_atlas(const String &p_path, const Vector<Vector<Vector2> > &p_uvs, AtlasResult &r_atlas) {
+	Error err = OK;
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ, &err);
+	ERR_FAIL_COND_V_MSG(file.is_null(), err, "Cannot read scene merge atlas from " + p_path + ".");
+	const uint32_t magic = file->get_32();
+	const uint32_t version = file->get_32();
+	const uint32_t real_size = file->get_32();
+	if (magic != atlas_sidecar_magic || version != atlas_sidecar_version || real_size != sizeof(real_t)) {
+		return ERR_FILE_UNRECOGNIZED;
+	}
+	r_atlas.width = file->get_32();
+	r_atlas.height = file->get_32();
+	const uint32_t mesh_count = file->get_32();
+	ERR_FAIL_COND_V_MSG(mesh_count != (uint32_t)p_uvs.size(), ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " does not match its merge group.");
+	r_atlas.meshes.resize(mesh_count);
+	for (uint32_t mesh_i = 0; mesh_i < mesh_count; mesh_i++) {
+		AtlasMeshData &mesh = r_atlas.meshes[mesh_i];
+		const uint32_t vertex_count = file->get_32();
+		const uint32_t index_count = file->get_32();
+		const uint32_t chart_count = file->get_32();
+		const uint32_t chart_face_count = file->get_32();
+		const uint64_t mesh_size = (sizeof(Vector2) + sizeof(uint32_t)) * uint64_t(vertex_count) + sizeof(uint32_t) * uint64_t(index_count) +
+				sizeof(AtlasChartData) * uint64_t(chart_count) + sizeof(uint32_t) * uint64_t(chart_face_count);
+		ERR_FAIL_COND_V_MSG(file->get_position() + mesh_size > file->get_length(), ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " is truncated.");
+		mesh.uvs.resize(vertex_count);
+		mesh.xrefs.resize(vertex_count);
+		mesh.indices.resize(index_count);
+		mesh.charts.resize(chart_count);
+		mesh.chart_faces.resize(chart_face_count);
+		file->get_buffer((uint8_t *)mesh.uvs.ptr(), sizeof(Vector2) * vertex_count);
+		file->get_buffer((uint8_t *)mesh.xrefs.ptr(), sizeof(uint32_t) * vertex_count);
+		file->get_buffer((uint8_t *)mesh.indices.ptr(), sizeof(uint32_t) * index_count);
+		file->get_buffer((uint8_t *)mesh.charts.ptr(), sizeof(AtlasChartData) * chart_count);
+		file->get_buffer((uint8_t *)mesh.chart_faces.ptr(), sizeof(uint32_t) * chart_face_count);
+		// Rasterization and output index through every table, so a damaged file must not get past here.
+		const uint32_t source_vertex_count = p_uvs[mesh_i].size();
+		for (uint32_t vertex_i = 0; vertex_i < vertex_count; vertex_i++) {
+			ERR_FAIL_COND_V_MSG(mesh.xrefs[vertex_i] >= source_vertex_count, ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " is corrupt.");
+		}
+		for (uint32_t index_i = 0; index_i < index_count; index_i++) {
+			ERR_FAIL_COND_V_MSG(mesh.indices[index_i] >= vertex_count, ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " is corrupt.");
+		}
+		for (const AtlasChartData &chart : mesh.charts) {
+			ERR_FAIL_COND_V_MSG(uint64_t(chart.first_face) + chart.face_count > chart_face_count, ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " is corrupt.");
+		}
+		for (uint32_t face_i = 0; face_i < chart_face_count; face_i++) {
+			ERR_FAIL_COND_V_MSG(mesh.chart_faces[face_i] >= index_count / 3, ERR_FILE_CORRUPT, "Scene merge atlas " + p_path + " is corrupt.");
 		}
 	}
-	pack_options.bilinear = true;
-	pack_options.padding = 16;
-	pack_options.texelsPerUnit = 0.0f;
-	pack_options.bruteForce = false;
-	pack_options.blockAlign = true;
-	pack_options.resolution = 2048;
-	xatlas::ComputeCharts(atlas);
-	xatlas::PackCharts(atlas, pack_options);
+	return OK;
 }
 
-void MeshMergeMaterialRepack::scale_uvs_by_texture_dimension(const Vector<MeshState> &original_mesh_items, Vector<MeshState> &mesh_items, Vector<Vector<Vector2> > &uv_groups, Array &r_mesh_to_index_to_material, Vector<Vector<ModelVertex> > &r_model_vertices) {
-	for (int32_t mesh_i = 0; mesh_i < mesh_items.size(); mesh_i++) {
-		for (int32_t j = 0; j < mesh_items[mesh_i].mesh->get_surface_count(); j++) {
-			r_model_vertices.push_back(Vector<ModelVertex>());
+// One source surface's UV2 rectangle in the merged lightmap layout.
+struct SourceUv2Cell {
+	uint32_t mesh = 0;
+	float size = 0.0f;
+	Vector2 position;
+	bool operator<(const SourceUv2Cell &p_other) const {
+		return size > p_other.size || (size == p_other.size && mesh < p_other.mesh);
+	}
+};
+
+bool MeshMergeMaterialRepack::_pack_source_uv2(const Vector<MeshState> &p_mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, Vector<Vector<ModelVertex> > &r_model_vertices) {
+	// Source UV2 is only kept when every surface has it. Each surface's UV2 bounds become a square cell whose side
+	// follows the square root of its scene space area, so lightmap texel density stays about even across the group.
+	LocalVector<SourceUv2Cell> cells;
+	LocalVector<Rect2> uv2_bounds;
+	float total_area = 0.0f;
+	for (int32_t mesh_i = 0; mesh_i < p_mesh_items.size(); mesh_i++) {
+		const SurfaceSnapshot &surface = p_surfaces[p_mesh_items[mesh_i].surface_id];
+		if (surface.uv2s.size() != surface.positions.size() || surface.positions.is_empty()) {
+			return false;
+		}
+		const ModelVertex *model_vertices = r_model_vertices[mesh_i].ptr();
+		float area = 0.0f;
+		for (uint32_t index_i = 0; index_i + 2 < surface.indices.size(); index_i += 3) {
+			const Vector3 &a = model_vertices[surface.indices[index_i]].pos;
+			const Vector3 &b = model_vertices[surface.indices[index_i + 1]].pos;
+			const Vector3 &c = model_vertices[surface.indices[index_i + 2]].pos;
+			area += (b - a).cross(c - a).length() * 0.5f;
+		}
+		Rect2 bounds = Rect2(surface.uv2s[0], Vector2());
+		for (uint32_t vertex_i = 1; vertex_i < surface.uv2s.size(); vertex_i++) {
+			bounds.expand_to(surface.uv2s[vertex_i]);
+		}
+		uv2_bounds.push_back(bounds);
+		SourceUv2Cell cell;
+		cell.mesh = mesh_i;
+		cell.size = Math::sqrt(MAX(area, CMP_EPSILON));
+		cells.push_back(cell);
+		total_area += cell.size * cell.size;
+	}
+	if (cells.is_empty()) {
+		return false;
+	}
+	// Shelf packing, largest cells first, into rows about as wide as the layout is tall.
+	cells.sort();
+	const float row_width = MAX(cells[0].size, Math::sqrt(total_area) * 1.1f);
+	Vector2 cursor;
+	float row_height = 0.0f;
+	float layout_width = 0.0f;
+	for (SourceUv2Cell &cell : cells) {
+		if (cursor.x > 0.0f && cursor.x + cell.size > row_width) {
+			cursor = Vector2(0.0f, cursor.y + row_height);
+			row_height = 0.0f;
 		}
+		cell.position = cursor;
+		cursor.x += cell.size;
+		row_height = MAX(row_height, cell.size);
+		layout_width = MAX(layout_width, cursor.x);
 	}
-	int32_t mesh_count = 0;
+	const float layout_scale = 1.0f / MAX(layout_width, cursor.y + row_height);
+	for (const SourceUv2Cell &cell : cells) {
+		const Rect2 &bounds = uv2_bounds[cell.mesh];
+		// A small margin inside every cell keeps neighbouring surfaces from bleeding into each other.
+		const float margin = cell.size * 0.02f;
+		const float extent = MAX(MAX(bounds.size.x, bounds.size.y), CMP_EPSILON);
+		const float scale = (cell.size - margin * 2.0f) / extent;
+		const Vector2 offset = cell.position + Vector2(margin, margin);
+		Vector<ModelVertex> &model_vertices = r_model_vertices.write[cell.mesh];
+		const SurfaceSnapshot &surface = p_surfaces[p_mesh_items[cell.mesh].surface_id];
+		ModelVertex *model_vertices_w = model_vertices.ptrw();
+		for (int32_t vertex_i = 0; vertex_i < model_vertices.size(); vertex_i++) {
+			model_vertices_w[vertex_i].uv2 = (offset + (surface.uv2s[vertex_i] - bounds.position) * scale) * layout_scale;
+		}
+	}
+	return true;
+}
+
+void MeshMergeMaterialRepack::_transform_surfaces(const Vector<MeshState> &original_mesh_items, const Vector<MeshState> &mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, Vector<Vector<ModelVertex> > &r_model_vertices) {
+	r_model_vertices.resize(mesh_items.size());
 	for (int32_t mesh_i = 0; mesh_i < mesh_items.size(); mesh_i++) {
-		for (int32_t surface_i = 0; surface_i < mesh_items[mesh_i].mesh->get_surface_count(); surface_i++) {
-			Ref<ArrayMesh> array_mesh = mesh_items[mesh_i].mesh;
-			Array mesh = array_mesh->surface_get_arrays(surface_i);
-			Vector<ModelVertex> model_vertices;
-			if (mesh.is_empty()) {
-				mesh_count++;
-				r_model_vertices.write[mesh_count] = model_vertices;
-				continue;
-			}
-			Array vertices = mesh[ArrayMesh::ARRAY_VERTEX];
-			if (vertices.size() == 0) {
-				mesh_count++;
-				r_model_vertices.write[mesh_count] = model_vertices;
-				continue;
-			}
-			Vector<Vector3> vertex_arr = mesh[Mesh::ARRAY_VERTEX];
-			Vector<Vector3> normal_arr = mesh[Mesh::ARRAY_NORMAL];
-			Vector<Vector2> uv_arr = mesh[Mesh::ARRAY_TEX_UV];
-			Vector<int32_t> index_arr = mesh[Mesh::ARRAY_INDEX];
-			Vector<Plane> tangent_arr = mesh[Mesh::ARRAY_TANGENT];
-			Transform3D xform = original_mesh_items[mesh_i].mesh_instance->get_global_transform();
-			model_vertices.resize(vertex_arr.size());
-			for (int32_t vertex_i = 0; vertex_i < vertex_arr.size(); vertex_i++) {
-				ModelVertex vertex;
-				vertex.pos = xform.xform(vertex_arr[vertex_i]);
-				if (uv_arr.size()) {
-					vertex.uv = uv_arr[vertex_i];
-				}
-				if (normal_arr.size()) {
-					vertex.normal = normal_arr[vertex_i];
-				}
-				model_vertices.write[vertex_i] = vertex;
-			}
-			r_model_vertices.write[mesh_count] = model_vertices;
-			mesh_count++;
+		const SurfaceSnapshot &surface = p_surfaces[mesh_items[mesh_i].surface_id];
+		const Transform3D xform = get_scene_global_transform(original_mesh_items[mesh_i].mesh_instance);
+		// Normals follow the inverse transpose, so they stay perpendicular under rotation and non-uniform scale.
+		const Basis normal_basis = xform.basis.inverse().transposed();
+		Vector<ModelVertex> &model_vertices = r_model_vertices.write[mesh_i];
+		model_vertices.resize(surface.positions.size());
+		ModelVertex *model_vertices_w = model_vertices.ptrw();
+		for (uint32_t vertex_i = 0; vertex_i < surface.positions.size(); vertex_i++) {
+			ModelVertex &vertex = model_vertices_w[vertex_i];
+			vertex.pos = xform.xform(surface.positions[vertex_i]);
+			vertex.normal = normal_basis.xform(surface.normals[vertex_i]).normalized();
+			vertex.uv = surface.uvs[vertex_i];
 		}
 	}
-	mesh_count = 0;
+}
+
+void MeshMergeMaterialRepack::scale_uvs_by_texture_dimension(const Vector<MeshState> &original_mesh_items, Vector<MeshState> &mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, const Vector<Ref<Material> > &p_material_cache, Vector<Vector<Vector2> > &uv_groups, Vector<Vector<ModelVertex> > &r_model_vertices) {
+	_transform_surfaces(original_mesh_items, mesh_items, p_surfaces, r_model_vertices);
 	for (int32_t mesh_i = 0; mesh_i < mesh_items.size(); mesh_i++) {
-		for (int32_t j = 0; j < mesh_items[mesh_i].mesh->get_surface_count(); j++) {
-			Array mesh = mesh_items[mesh_i].mesh->surface_get_arrays(j);
-			if (mesh.is_empty()) {
-				uv_groups.push_back(Vector<Vector2>());
-				mesh_count++;
-				continue;
-			}
-			Vector<Vector3> vertices = mesh[ArrayMesh::ARRAY_VERTEX];
-			if (vertices.size() == 0) {
-				mesh_count++;
-				uv_groups.push_back(Vector<Vector2>());
-				continue;
-			}
-			Vector<Vector2> uvs;
-			uvs.resize(vertices.size());
-			Vector<int32_t> indices = mesh[ArrayMesh::ARRAY_INDEX];
-			for (int32_t vertex_i = 0; vertex_i < vertices.size(); vertex_i++) {
-				if (mesh_count >= r_mesh_to_index_to_material.size()) {
-					uvs.resize(0);
-					break;
-				}
-				Array index_to_material = r_mesh_to_index_to_material[mesh_count];
-				if (!index_to_material.size()) {
-					continue;
-				}
-				int32_t index = indices.find(vertex_i);
-				if (index >= index_to_material.size()) {
-					continue;
-				}
-				ERR_CONTINUE(index == -1);
-				const Ref<Material> material = index_to_material.get(index);
-				if (material.is_null()) {
-					uvs.resize(0);
-					continue;
-				}
-				Ref<BaseMaterial3D> Node3D_material = material;
-				if (Node3D_material.is_null()) {
-					continue;
-				}
-				const Ref<Texture2D> tex = Node3D_material->get_texture(BaseMaterial3D::TextureParam::TEXTURE_ALBEDO);
-				uvs.write[vertex_i] = r_model_vertices[mesh_count][vertex_i].uv;
-				if (tex.is_valid()) {
-					uvs.write[vertex_i].x *= tex->get_width();
-					uvs.write[vertex_i].y *= tex->get_height();
-				}
-			}
+		const SurfaceSnapshot &surface = p_surfaces[mesh_items[mesh_i].surface_id];
+		const Ref<Material> material = p_material_cache[surface.material_id];
+		if (surface.positions.is_empty() || material.is_null()) {
+			uv_groups.push_back(Vector<Vector2>());
+			continue;
+		}
+		Vector<Vector2> uvs;
+		uvs.resize(surface.positions.size());
+		Ref<BaseMaterial3D> base_material = material;
+		if (base_material.is_null()) {
 			uv_groups.push_back(uvs);
-			mesh_count++;
+			continue;
 		}
+		Vector2 texture_size = Vector2(1.0f, 1.0f);
+		const Ref<Texture2D> tex = base_material->get_texture(BaseMaterial3D::TextureParam::TEXTURE_ALBEDO);
+		if (tex.is_valid()) {
+			texture_size = tex->get_size();
+		}
+		Vector2 *uvs_w = uvs.ptrw();
+		const ModelVertex *model_vertices_r = r_model_vertices[mesh_i].ptr();
+		for (uint32_t vertex_i = 0; vertex_i < surface.positions.size(); vertex_i++) {
+			uvs_w[vertex_i] = model_vertices_r[vertex_i].uv * texture_size;
+		}
+		uv_groups.push_back(uvs);
 	}
 }
+
 Ref<Image> MeshMergeMaterialRepack::dilate(Ref<Image> source_image) {
 	Ref<Image> target_image = source_image->duplicate();
 	target_image->convert(Image::FORMAT_RGBA8);
@@ -901,159 +2287,591 @@ Ref<Image> MeshMergeMaterialRepack::dilate(Ref<Image> source_image) {
 	return target_image;
 }
 
-void MeshMergeMaterialRepack::map_mesh_to_index_to_material(const Vector<MeshState> mesh_items, Array &mesh_to_index_to_material, Vector<Ref<Material> > &material_cache) {
+// Materials of the same class with equal stored properties get equal signatures. Resource names are left out and
+// textures are compared by path when they have one, so duplicates made on import or loaded twice still match.
+static Array get_material_signature(const Ref<Material> &p_material) {
+	Array signature;
+	signature.push_back(p_material->get_class_name());
+	List<PropertyInfo> properties;
+	p_material->get_property_list(&properties);
+	for (const PropertyInfo &property : properties) {
+		if (!(property.usage & PROPERTY_USAGE_STORAGE) || property.name.begins_with("resource_")) {
+			continue;
+		}
+		Variant value = p_material->get(property.name);
+		const Ref<Resource> resource = value;
+		if (resource.is_valid() && !resource->get_path().is_empty()) {
+			value = resource->get_path();
+		}
+		signature.push_back(property.name);
+		signature.push_back(value);
+	}
+	return signature;
+}
+
+void MeshMergeMaterialRepack::map_mesh_to_material(const Vector<MeshState> &mesh_items, LocalVector<SurfaceSnapshot> &r_surfaces, Vector<Ref<Material> > &material_cache) {
+	// Equivalent materials share one cache entry, so their textures are decoded once and packed as one material.
+	HashMap<ObjectID, int32_t> material_to_index;
+	HashMap<Variant, int32_t, VariantHasher, VariantComparator> signature_to_index;
 	for (int32_t mesh_i = 0; mesh_i < mesh_items.size(); mesh_i++) {
-		Ref<ArrayMesh> array_mesh = mesh_items[mesh_i].mesh;
-		array_mesh->lightmap_unwrap(Transform3D(), 2.0f, true);
-
-		for (int32_t j = 0; j < array_mesh->get_surface_count(); j++) {
-			Array mesh = array_mesh->surface_get_arrays(j);
-			Vector<Vector3> indices = mesh[ArrayMesh::ARRAY_INDEX];
-			Ref<Material> mat = mesh_items[mesh_i].mesh->surface_get_material(j);
-			if (mesh_items[mesh_i].mesh_instance->get_active_material(j).is_valid()) {
-				mat = mesh_items[mesh_i].mesh_instance->get_active_material(j);
-			}
-			if (material_cache.find(mat) == -1) {
+		Ref<Material> mat = mesh_items[mesh_i].mesh->surface_get_material(0);
+		if (mesh_items[mesh_i].mesh_instance->get_active_material(0).is_valid()) {
+			mat = mesh_items[mesh_i].mesh_instance->get_active_material(0);
+		}
+		int32_t material_i = 0;
+		if (mat.is_null()) {
+			material_i = material_cache.find(mat);
+		} else if (const int32_t *known = material_to_index.getptr(mat->get_instance_id())) {
+			material_i = *known;
+		} else {
+			const Array signature = get_material_signature(mat);
+			if (const int32_t *equivalent = signature_to_index.getptr(signature)) {
+				material_i = *equivalent;
+			} else {
+				material_i = material_cache.size();
 				material_cache.push_back(mat);
+				signature_to_index.insert(signature, material_i);
 			}
-			Array materials;
-			materials.resize(indices.size());
-			for (int32_t index_i = 0; index_i < indices.size(); index_i++) {
-				materials[index_i] = mat;
+			material_to_index.insert(mat->get_instance_id(), material_i);
+		}
+		if (material_i == -1) {
+			material_i = material_cache.size();
+			material_cache.push_back(mat);
+		}
+		r_surfaces[mesh_items[mesh_i].surface_id].material_id = material_i;
+	}
+}
+
+template <class T>
+static T remap_vertex_stream(const T &p_stream, const LocalVector<uint32_t> &p_remap, uint32_t p_vertex_count, uint32_t p_new_vertex_count) {
+	const int32_t components = p_stream.size() / p_vertex_count;
+	T result;
+	result.resize(p_new_vertex_count * components);
+	meshopt_remapVertexBuffer(result.ptrw(), p_stream.ptr(), p_vertex_count, sizeof(p_stream[0]) * components, p_remap.ptr());
+	return result;
+}
+
+// Every per-vertex array of a surface, as raw meshoptimizer streams or remapped into a new vertex order.
+static void get_vertex_streams(const Array &p_arrays, uint32_t p_vertex_count, LocalVector<meshopt_Stream> &r_streams) {
+	for (int32_t array_i = 0; array_i < Mesh::ARRAY_MAX; array_i++) {
+		if (array_i == Mesh::ARRAY_INDEX) {
+			continue;
+		}
+		const Variant &stream = p_arrays[array_i];
+		const void *data = nullptr;
+		size_t size = 0;
+		switch (stream.get_type()) {
+			case Variant::PACKED_VECTOR3_ARRAY: {
+				const PackedVector3Array &values = *VariantInternal::get_vector3_array(&stream);
+				data = values.ptr();
+				size = sizeof(Vector3) * values.size();
+			} break;
+			case Variant::PACKED_VECTOR2_ARRAY: {
+				const PackedVector2Array &values = *VariantInternal::get_vector2_array(&stream);
+				data = values.ptr();
+				size = sizeof(Vector2) * values.size();
+			} break;
+			case Variant::PACKED_FLOAT32_ARRAY: {
+				const PackedFloat32Array &values = *VariantInternal::get_float32_array(&stream);
+				data = values.ptr();
+				size = sizeof(float) * values.size();
+			} break;
+			case Variant::PACKED_FLOAT64_ARRAY: {
+				const PackedFloat64Array &values = *VariantInternal::get_float64_array(&stream);
+				data = values.ptr();
+				size = sizeof(double) * values.size();
+			} break;
+			case Variant::PACKED_COLOR_ARRAY: {
+				const PackedColorArray &values = *VariantInternal::get_color_array(&stream);
+				data = values.ptr();
+				size = sizeof(Color) * values.size();
+			} break;
+			case Variant::PACKED_INT32_ARRAY: {
+				const PackedInt32Array &values = *VariantInternal::get_int32_array(&stream);
+				data = values.ptr();
+				size = sizeof(int32_t) * values.size();
+			} break;
+			case Variant::PACKED_BYTE_ARRAY: {
+				const PackedByteArray &values = *VariantInternal::get_byte_array(&stream);
+				data = values.ptr();
+				size = values.size();
+			} break;
+			default:
+				break;
+		}
+		if (data && size) {
+			const size_t stride = size / p_vertex_count;
+			r_streams.push_back({ data, stride, stride });
+		}
+	}
+}
+
+static void remap_vertex_streams(Array &r_arrays, const LocalVector<uint32_t> &p_remap, uint32_t p_vertex_count, uint32_t p_new_vertex_count) {
+	for (int32_t array_i = 0; array_i < Mesh::ARRAY_MAX; array_i++) {
+		if (array_i == Mesh::ARRAY_INDEX) {
+			continue;
+		}
+		const Variant stream = r_arrays[array_i];
+		switch (stream.get_type()) {
+			case Variant::PACKED_VECTOR3_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedVector3Array(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_VECTOR2_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedVector2Array(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_FLOAT32_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedFloat32Array(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_FLOAT64_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedFloat64Array(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_COLOR_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedColorArray(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_INT32_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedInt32Array(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			case Variant::PACKED_BYTE_ARRAY:
+				r_arrays[array_i] = remap_vertex_stream(PackedByteArray(stream), p_remap, p_vertex_count, p_new_vertex_count);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// meshoptimizer reads float positions, which Vector3 is not in double precision builds.
+static void get_float_positions(const PackedVector3Array &p_positions, LocalVector<float> &r_positions) {
+	r_positions.resize(p_positions.size() * 3);
+	const Vector3 *positions = p_positions.ptr();
+	for (int32_t vertex_i = 0; vertex_i < p_positions.size(); vertex_i++) {
+		r_positions[vertex_i * 3 + 0] = positions[vertex_i].x;
+		r_positions[vertex_i * 3 + 1] = positions[vertex_i].y;
+		r_positions[vertex_i * 3 + 2] = positions[vertex_i].z;
+	}
+}
+
+void MeshMergeMaterialRepack::_optimize_surface_arrays(Array &r_arrays, int p_count) {
+	if (!optimize_vertex_order && !weld_vertices) {
+		return;
+	}
+	PackedInt32Array index_array = r_arrays[Mesh::ARRAY_INDEX];
+	const PackedVector3Array positions = r_arrays[Mesh::ARRAY_VERTEX];
+	uint32_t vertex_count = positions.size();
+	if (index_array.is_empty() || vertex_count == 0) {
+		return;
+	}
+	const int32_t stage = _begin_stage("optimize", p_count);
+	unsigned int *indices = (unsigned int *)index_array.ptrw();
+	const size_t index_count = index_array.size();
+	LocalVector<uint32_t> remap;
+	remap.resize(vertex_count);
+	if (weld_vertices) {
+		// Only vertices equal in every attribute are merged. Copies on either side of a chart seam differ in their atlas
+		// UV and stay apart, so no texel moves.
+		LocalVector<meshopt_Stream> streams;
+		get_vertex_streams(r_arrays, vertex_count, streams);
+		const uint32_t unique_count = meshopt_generateVertexRemapMulti(remap.ptr(), indices, index_count, vertex_count, streams.ptr(), streams.size());
+		meshopt_remapIndexBuffer(indices, indices, index_count, remap.ptr());
+		remap_vertex_streams(r_arrays, remap, vertex_count, unique_count);
+		vertex_count = unique_count;
+	}
+	if (optimize_vertex_order) {
+		meshopt_optimizeVertexCache(indices, indices, index_count, vertex_count);
+		LocalVector<float> float_positions;
+		get_float_positions(r_arrays[Mesh::ARRAY_VERTEX], float_positions);
+		meshopt_optimizeOverdraw(indices, indices, index_count, float_positions.ptr(), vertex_count, sizeof(float) * 3, 1.05f);
+		const uint32_t fetch_count = meshopt_optimizeVertexFetchRemap(remap.ptr(), indices, index_count, vertex_count);
+		meshopt_remapIndexBuffer(indices, indices, index_count, remap.ptr());
+		remap_vertex_streams(r_arrays, remap, vertex_count, fetch_count);
+		vertex_count = fetch_count;
+	}
+	r_arrays[Mesh::ARRAY_INDEX] = index_array;
+	_end_stage(stage, vertex_count);
+}
+
+Dictionary MeshMergeMaterialRepack::_generate_lods(const Array &p_arrays, int p_count) {
+	Dictionary lods;
+	const PackedInt32Array index_array = p_arrays[Mesh::ARRAY_INDEX];
+	const PackedVector3Array positions = p_arrays[Mesh::ARRAY_VERTEX];
+	if (lod_count <= 0 || index_array.is_empty() || positions.is_empty()) {
+		return lods;
+	}
+	const int32_t stage = _begin_stage("lod", p_count);
+	LocalVector<float> float_positions;
+	get_float_positions(positions, float_positions);
+	const unsigned int *indices = (const unsigned int *)index_array.ptr();
+	const size_t index_count = index_array.size();
+	// Godot keys LODs by their error in mesh units, meshoptimizer reports it relative to the mesh extents.
+	const float error_scale = meshopt_simplifyScale(float_positions.ptr(), positions.size(), sizeof(float) * 3);
+	size_t previous_count = index_count;
+	float previous_error = 0.0f;
+	uint64_t lod_triangles = 0;
+	LocalVector<uint32_t> lod_indices;
+	lod_indices.resize(index_count);
+	for (int32_t lod_i = 0; lod_i < lod_count; lod_i++) {
+		const size_t target_count = size_t(previous_count * lod_reduction) / 3 * 3;
+		if (target_count < 3) {
+			break;
+		}
+		// Each level starts from the full mesh. Vertices split along chart seams are only collapsed along the seam, so
+		// atlas texels stay on their charts.
+		float error = 0.0f;
+		const size_t lod_index_count = meshopt_simplify(lod_indices.ptr(), indices, index_count, float_positions.ptr(), positions.size(), sizeof(float) * 3,
+				target_count, lod_max_error, 0, &error);
+		if (lod_index_count == 0 || lod_index_count >= previous_count) {
+			break;
+		}
+		meshopt_optimizeVertexCache(lod_indices.ptr(), lod_indices.ptr(), lod_index_count, positions.size());
+		PackedInt32Array lod;
+		lod.resize(lod_index_count);
+		memcpy(lod.ptrw(), lod_indices.ptr(), sizeof(uint32_t) * lod_index_count);
+		const float distance = MAX(error * error_scale, previous_error + CMP_EPSILON);
+		lods[distance] = lod;
+		previous_count = lod_index_count;
+		previous_error = distance;
+		lod_triangles += lod_index_count / 3;
+	}
+	_end_stage(stage, lod_triangles);
+	return lods;
+}
+
+void MeshMergeMaterialRepack::_add_merged_surface(const Ref<ArrayMesh> &p_mesh, Array &r_arrays, const Ref<Material> &p_material, int p_count) {
+	_optimize_surface_arrays(r_arrays, p_count);
+	p_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, r_arrays, Array(), _generate_lods(r_arrays, p_count));
+	if (p_material.is_valid()) {
+		p_mesh->surface_set_material(p_mesh->get_surface_count() - 1, p_material);
+	}
+}
+
+Ref<ArrayMesh> MeshMergeMaterialRepack::_simplify_hlod_proxy(const Ref<ArrayMesh> &p_mesh, int32_t p_level, int p_count) {
+	const int32_t stage = _begin_stage("hlod_simplify", p_count);
+	const float ratio = Math::pow(hlod_reduction, (float)p_level);
+	// Proxy cells and their visibility distance both double with every level, so an error relative to the cell keeps
+	// about the same size on screen at every level. Without a cell size the proxy's own extents stand in for it.
+	const float cell_extent = hlod_cell_size * (1 << (p_level - 1));
+	uint64_t triangle_count = 0;
+	Ref<ArrayMesh> proxy_mesh;
+	proxy_mesh.instantiate();
+	for (int32_t surface_i = 0; surface_i < p_mesh->get_surface_count(); surface_i++) {
+		Array arrays = p_mesh->surface_get_arrays(surface_i);
+		const PackedInt32Array index_array = arrays[Mesh::ARRAY_INDEX];
+		const PackedVector3Array positions = arrays[Mesh::ARRAY_VERTEX];
+		const size_t target_count = size_t(index_array.size() * ratio) / 3 * 3;
+		if (target_count >= 3 && !positions.is_empty()) {
+			LocalVector<float> float_positions;
+			get_float_positions(positions, float_positions);
+			// meshoptimizer measures error relative to the surface extents.
+			const float surface_scale = meshopt_simplifyScale(float_positions.ptr(), positions.size(), sizeof(float) * 3);
+			const float target_error = cell_extent > 0.0f && surface_scale > 0.0f ? hlod_max_error * cell_extent / surface_scale : hlod_max_error;
+			LocalVector<uint32_t> simplified_indices;
+			simplified_indices.resize(index_array.size());
+			const size_t index_count = meshopt_simplify(simplified_indices.ptr(), (const unsigned int *)index_array.ptr(), index_array.size(), float_positions.ptr(), positions.size(),
+					sizeof(float) * 3, target_count, target_error, 0, nullptr);
+			if (index_count > 0) {
+				// Only the vertices the simplified triangles still use are kept.
+				LocalVector<uint32_t> remap;
+				remap.resize(positions.size());
+				const uint32_t vertex_count = meshopt_optimizeVertexFetchRemap(remap.ptr(), simplified_indices.ptr(), index_count, positions.size());
+				PackedInt32Array indices;
+				indices.resize(index_count);
+				meshopt_remapIndexBuffer((unsigned int *)indices.ptrw(), simplified_indices.ptr(), index_count, remap.ptr());
+				remap_vertex_streams(arrays, remap, positions.size(), vertex_count);
+				arrays[Mesh::ARRAY_INDEX] = indices;
 			}
-			mesh_to_index_to_material.push_back(materials);
 		}
+		triangle_count += PackedInt32Array(arrays[Mesh::ARRAY_INDEX]).size() / 3;
+		_add_merged_surface(proxy_mesh, arrays, p_mesh->surface_get_material(surface_i), p_count);
 	}
+	_end_stage(stage, triangle_count);
+	return proxy_mesh;
 }
 
-Node *MeshMergeMaterialRepack::_output(MergeState &state, int p_count) {
+Ref<ArrayMesh> MeshMergeMaterialRepack::_build_output(MergeState &state, int p_count) {
 	if (state.atlas->width == 0 || state.atlas->height == 0) {
-		return state.p_root;
+		return Ref<ArrayMesh>();
 	}
-	MeshMergeMaterialRepack::TextureData texture_data;
-	for (int32_t mesh_i = 0; mesh_i < state.r_mesh_items.size(); mesh_i++) {
-		if (state.r_mesh_items[mesh_i].mesh_instance->get_parent()) {
-			Node3D *node_3d = memnew(Node3D);
-			Transform3D xform = state.r_mesh_items[mesh_i].mesh_instance->get_transform();
-			node_3d->set_transform(xform);
-			node_3d->set_name(state.r_mesh_items[mesh_i].mesh_instance->get_name());
-			state.r_mesh_items[mesh_i].mesh_instance->replace_by(node_3d);
-		}
-	}
-	Ref<SurfaceTool> st_all;
-	st_all.instantiate();
-	st_all->begin(Mesh::PRIMITIVE_TRIANGLES);
-	for (uint32_t mesh_i = 0; mesh_i < state.atlas->meshCount; mesh_i++) {
-		Ref<SurfaceTool> st;
-		st.instantiate();
-		st->begin(Mesh::PRIMITIVE_TRIANGLES);
-		const xatlas::Mesh &mesh = state.atlas->meshes[mesh_i];
-		for (uint32_t v = 0; v < mesh.vertexCount; v++) {
-			const xatlas::Vertex vertex = mesh.vertexArray[v];
-			const ModelVertex &sourceVertex = state.model_vertices[mesh_i][vertex.xref];
-			Vector2 uv = Vector2(vertex.uv[0] / state.atlas->width, vertex.uv[1] / state.atlas->height);
-			st->set_uv(uv);
-			st->set_normal(sourceVertex.normal);
-			st->set_color(Color(1.0f, 1.0f, 1.0f));
-			st->add_vertex(sourceVertex.pos);
-		}
-		for (uint32_t f = 0; f < mesh.indexCount; f++) {
-			const uint32_t index = mesh.indexArray[f];
-			st->add_index(index);
-		}
-		st->generate_tangents();
-		Ref<ArrayMesh> array_mesh = st->commit();
-		st_all->append_from(array_mesh, 0, Transform3D());
+	int32_t stage = _begin_stage("output_mesh_build", p_count);
+	// Every atlas mesh is written straight into one set of preallocated surface arrays.
+	int32_t output_vertex_count = 0;
+	int32_t output_index_count = 0;
+	for (uint32_t mesh_i = 0; mesh_i < state.atlas->meshes.size(); mesh_i++) {
+		output_vertex_count += state.atlas->meshes[mesh_i].uvs.size();
+		output_index_count += state.atlas->meshes[mesh_i].indices.size();
 	}
+	PackedVector3Array positions;
+	PackedVector3Array normals;
+	PackedVector2Array uvs;
+	PackedVector2Array uv2s;
+	PackedInt32Array indices;
+	positions.resize(output_vertex_count);
+	normals.resize(output_vertex_count);
+	uvs.resize(output_vertex_count);
+	uv2s.resize(state.has_uv2 ? output_vertex_count : 0);
+	indices.resize(output_index_count);
+	Vector3 *positions_w = positions.ptrw();
+	Vector3 *normals_w = normals.ptrw();
+	Vector2 *uvs_w = uvs.ptrw();
+	Vector2 *uv2s_w = uv2s.ptrw();
+	int32_t *indices_w = indices.ptrw();
+	const Vector2 texel_size = Vector2(1.0f / state.atlas->width, 1.0f / state.atlas->height);
+	int32_t base_vertex = 0;
+	int32_t base_index = 0;
+	for (uint32_t mesh_i = 0; mesh_i < state.atlas->meshes.size(); mesh_i++) {
+		const AtlasMeshData &mesh = state.atlas->meshes[mesh_i];
+		const ModelVertex *model_vertices = state.model_vertices[mesh_i].ptr();
+		for (uint32_t v = 0; v < mesh.uvs.size(); v++) {
+			const ModelVertex &sourceVertex = model_vertices[mesh.xrefs[v]];
+			positions_w[base_vertex + v] = sourceVertex.pos;
+			normals_w[base_vertex + v] = sourceVertex.normal;
+			uvs_w[base_vertex + v] = mesh.uvs[v] * texel_size;
+			if (state.has_uv2) {
+				uv2s_w[base_vertex + v] = sourceVertex.uv2;
+			}
+		}
+		for (uint32_t f = 0; f < mesh.indices.size(); f++) {
+			indices_w[base_index + f] = base_vertex + mesh.indices[f];
+		}
+		base_vertex += mesh.uvs.size();
+		base_index += mesh.indices.size();
+	}
+	Array arrays;
+	arrays.resize(Mesh::ARRAY_MAX);
+	arrays[Mesh::ARRAY_VERTEX] = positions;
+	arrays[Mesh::ARRAY_NORMAL] = normals;
+	arrays[Mesh::ARRAY_TEX_UV] = uvs;
+	if (state.has_uv2) {
+		arrays[Mesh::ARRAY_TEX_UV2] = uv2s;
+	}
+	arrays[Mesh::ARRAY_INDEX] = indices;
+	generate_tangents(arrays);
+	_end_stage(stage, output_vertex_count);
+	Ref<ArrayMesh> array_mesh;
+	array_mesh.instantiate();
+	_add_merged_surface(array_mesh, arrays, Ref<Material>(), p_count);
+
 	Ref<ORMMaterial3D> mat;
 	mat.instantiate();
 	mat->set_name("Atlas");
-	HashMap<String, Ref<Image> >::Iterator A = state.texture_atlas.find("albedo");
-	Image::CompressMode compress_mode = Image::COMPRESS_ETC;
-	if (Image::_image_compress_bc_func) {
-		compress_mode = Image::COMPRESS_S3TC;
+	Ref<ImageTexture> textures[ATLAS_TEXTURE_MAX];
+	_compress_atlas_textures(state.texture_atlas, textures, p_count);
+	if (textures[ATLAS_TEXTURE_ALBEDO].is_valid()) {
+		mat->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, textures[ATLAS_TEXTURE_ALBEDO]);
 	}
-	if (A && !A->key.is_empty()) {
-		Ref<Image> img = dilate(A->value);
-		img->compress(compress_mode, Image::COMPRESS_SOURCE_SRGB);
-		String path = state.output_path;
-		String base_dir = path.get_base_dir();
-		path = base_dir.path_to_file(path.get_basename().get_file() + "_albedo");
-		Ref<DirAccess> directory = DirAccess::create(DirAccess::AccessType::ACCESS_FILESYSTEM);
-		path += "_" + itos(p_count) + ".res";
-		Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-		ResourceSaver::save(tex, path);
-		Ref<Texture2D> res = ResourceLoader::load(path, "Texture2D");
-		mat->set_texture(BaseMaterial3D::TEXTURE_ALBEDO, res);
-	}
-	HashMap<String, Ref<Image> >::Iterator E = state.texture_atlas.find("emission");
-	if (E && !E->key.is_empty()) {
-		Ref<Image> img = dilate(E->value);
-		img->compress(compress_mode);
-		String path = state.output_path;
-		String base_dir = path.get_base_dir();
-		path = base_dir.path_join(path.get_basename().get_file() + "_emission");
-		Ref<DirAccess> directory = DirAccess::create(DirAccess::AccessType::ACCESS_FILESYSTEM);
-		path += "_" + itos(p_count) + ".res";
-		Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-		ResourceSaver::save(tex, path);
-		Ref<Texture2D> res = ResourceLoader::load(path, "Texture2D");
+	if (textures[ATLAS_TEXTURE_EMISSION].is_valid()) {
 		mat->set_feature(BaseMaterial3D::FEATURE_EMISSION, true);
-		mat->set_texture(BaseMaterial3D::TEXTURE_EMISSION, res);
-	}
-	HashMap<String, Ref<Image> >::Iterator N = state.texture_atlas.find("normal");
-	if (N && !N->key.is_empty()) {
-		Ref<Image> img = dilate(N->value);
-		img->compress(compress_mode, Image::COMPRESS_SOURCE_NORMAL);
-		String path = state.output_path;
-		String base_dir = path.get_base_dir();
-		path = base_dir.path_join(path.get_basename().get_file() + "_normal");
-		Ref<DirAccess> directory = DirAccess::create(DirAccess::AccessType::ACCESS_FILESYSTEM);
-		path += "_" + itos(p_count) + ".res";
-		Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-		ResourceSaver::save(tex, path);
-		Ref<Texture2D> res = ResourceLoader::load(path, "Texture2D");
+		mat->set_texture(BaseMaterial3D::TEXTURE_EMISSION, textures[ATLAS_TEXTURE_EMISSION]);
+	}
+	if (textures[ATLAS_TEXTURE_NORMAL].is_valid()) {
 		mat->set_feature(BaseMaterial3D::FEATURE_NORMAL_MAPPING, true);
-		mat->set_texture(BaseMaterial3D::TEXTURE_NORMAL, res);
-	}
-	HashMap<String, Ref<Image> >::Iterator ORM = state.texture_atlas.find("orm");
-	if (ORM && !ORM->key.is_empty()) {
-		Ref<Image> img = dilate(ORM->value);
-		img->compress(compress_mode);
-		String path = state.output_path;
-		String base_dir = path.get_base_dir();
-		path = base_dir.path_join(path.get_basename().get_file() + "_orm");
-		Ref<DirAccess> directory = DirAccess::create(DirAccess::AccessType::ACCESS_FILESYSTEM);
-		path += "_" + itos(p_count) + ".res";
-		Ref<ImageTexture> tex = ImageTexture::create_from_image(img);
-		ResourceSaver::save(tex, path);
-		Ref<Texture2D> res = ResourceLoader::load(path, "Texture2D");
+		mat->set_texture(BaseMaterial3D::TEXTURE_NORMAL, textures[ATLAS_TEXTURE_NORMAL]);
+	}
+	if (textures[ATLAS_TEXTURE_ORM].is_valid()) {
 		mat->set_cull_mode(BaseMaterial3D::CULL_DISABLED);
 		mat->set_ao_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_RED);
 		mat->set_feature(BaseMaterial3D::FEATURE_AMBIENT_OCCLUSION, true);
-		mat->set_texture(BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION, tex);
+		mat->set_texture(BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION, textures[ATLAS_TEXTURE_ORM]);
 		mat->set_roughness_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_GREEN);
-		mat->set_texture(BaseMaterial3D::TEXTURE_ROUGHNESS, tex);
+		mat->set_texture(BaseMaterial3D::TEXTURE_ROUGHNESS, textures[ATLAS_TEXTURE_ORM]);
 		mat->set_metallic_texture_channel(BaseMaterial3D::TEXTURE_CHANNEL_BLUE);
 		mat->set_metallic(1.0);
-		mat->set_texture(BaseMaterial3D::TEXTURE_METALLIC, res);
+		mat->set_texture(BaseMaterial3D::TEXTURE_METALLIC, textures[ATLAS_TEXTURE_ORM]);
+	}
+	array_mesh->surface_set_material(0, mat);
+	return array_mesh;
+}
+
+void MeshMergeMaterialRepack::_compress_atlas_textures(const Ref<Image> p_atlas[ATLAS_TEXTURE_MAX], Ref<ImageTexture> r_textures[ATLAS_TEXTURE_MAX], int p_count) {
+	Image::CompressMode compress_mode = Image::COMPRESS_ETC;
+	if (Image::_image_compress_bc_func) {
+		compress_mode = Image::COMPRESS_S3TC;
+	}
+	const Image::CompressSource compress_sources[ATLAS_TEXTURE_MAX] = {
+		Image::COMPRESS_SOURCE_SRGB,
+		Image::COMPRESS_SOURCE_GENERIC,
+		Image::COMPRESS_SOURCE_NORMAL,
+		Image::COMPRESS_SOURCE_GENERIC,
+	};
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		if (p_atlas[texture_i].is_null()) {
+			continue;
+		}
+		int32_t stage = _begin_stage("dilate", p_count);
+		Ref<Image> img = dilate(p_atlas[texture_i]);
+		_end_stage(stage, img->get_width() * img->get_height());
+		stage = _begin_stage("compress", p_count);
+		img->compress(compress_mode, compress_sources[texture_i]);
+		_end_stage(stage, img->get_width() * img->get_height());
+		r_textures[texture_i] = ImageTexture::create_from_image(img);
+	}
+}
+
+String MeshMergeMaterialRepack::_get_output_texture_path(const String &p_output_path, int32_t p_texture, int p_count) const {
+	const char *texture_suffixes[ATLAS_TEXTURE_MAX] = { "_albedo", "_emission", "_normal", "_orm" };
+	return p_output_path.get_base_dir().path_join(p_output_path.get_basename().get_file() + texture_suffixes[p_texture] + "_" + itos(p_count) + ".res");
+}
+
+String MeshMergeMaterialRepack::_get_lookup_path(const String &p_output_path, int p_count) const {
+	return p_output_path.get_base_dir().path_join(p_output_path.get_basename().get_file() + "_lookup_" + itos(p_count) + ".lookup");
+}
+
+// Lookup maps are mostly long runs of one material, so they are stored zstd compressed: magic, version, width,
+// height and material count, then the texels in row order.
+static const uint32_t lookup_magic = 0x4b4c4d53; // "SMLK"
+static const uint32_t lookup_version = 1;
+
+Error MeshMergeMaterialRepack::_save_lookup(const String &p_path, uint32_t p_width, uint32_t p_height, uint32_t p_material_count, const Vector<AtlasLookupTexel> &p_lookup) {
+	ERR_FAIL_COND_V(uint64_t(p_width) * p_height != (uint64_t)p_lookup.size(), ERR_INVALID_PARAMETER);
+	Ref<FileAccess> file = FileAccess::open_compressed(p_path, FileAccess::WRITE, FileAccess::COMPRESSION_ZSTD);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_WRITE, "Cannot write scene merge lookup map to " + p_path + ".");
+	file->store_32(lookup_magic);
+	file->store_32(lookup_version);
+	file->store_32(p_width);
+	file->store_32(p_height);
+	file->store_32(p_material_count);
+	file->store_buffer((const uint8_t *)p_lookup.ptr(), sizeof(AtlasLookupTexel) * p_lookup.size());
+	return file->get_error() == OK ? OK : ERR_FILE_CANT_WRITE;
+}
+
+Error MeshMergeMaterialRepack::_load_lookup(const String &p_path, uint32_t p_material_count, uint32_t &r_width, uint32_t &r_height, Vector<AtlasLookupTexel> &r_lookup) {
+	Ref<FileAccess> file = FileAccess::open_compressed(p_path, FileAccess::READ, FileAccess::COMPRESSION_ZSTD);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_OPEN, "Cannot read scene merge lookup map from " + p_path + ".");
+	ERR_FAIL_COND_V_MSG(file->get_32() != lookup_magic || file->get_32() != lookup_version, ERR_FILE_UNRECOGNIZED, "Scene merge lookup map " + p_path + " has an unsupported format.");
+	r_width = file->get_32();
+	r_height = file->get_32();
+	ERR_FAIL_COND_V_MSG(file->get_32() != p_material_count, ERR_FILE_MISMATCH, "The materials of the scene no longer match " + p_path + ". Merge the scene again instead of re-baking.");
+	const uint64_t texel_count = uint64_t(r_width) * r_height;
+	ERR_FAIL_COND_V_MSG(file->get_position() + sizeof(AtlasLookupTexel) * texel_count > file->get_length(), ERR_FILE_CORRUPT, "Scene merge lookup map " + p_path + " is truncated.");
+	r_lookup.resize(texel_count);
+	file->get_buffer((uint8_t *)r_lookup.ptrw(), sizeof(AtlasLookupTexel) * texel_count);
+	const AtlasLookupTexel *lookup = r_lookup.ptr();
+	for (uint64_t texel_i = 0; texel_i < texel_count; texel_i++) {
+		ERR_FAIL_COND_V_MSG(lookup[texel_i].material_index >= p_material_count, ERR_FILE_CORRUPT, "Scene merge lookup map " + p_path + " is corrupt.");
+	}
+	return OK;
+}
+
+Error MeshMergeMaterialRepack::_rebake_group(const Vector<MeshState> &p_mesh_items, LocalVector<SurfaceSnapshot> &p_surfaces, const String &p_output_path, int p_index) {
+	Vector<Ref<Material> > material_cache;
+	material_cache.push_back(Ref<Material>());
+	map_mesh_to_material(p_mesh_items, p_surfaces, material_cache);
+
+	int32_t stage = _begin_stage("lookup_load", p_index);
+	GatherAtlasJob job;
+	Vector<AtlasLookupTexel> lookup;
+	const Error err = _load_lookup(_get_lookup_path(p_output_path, p_index), material_cache.size(), job.width, job.height, lookup);
+	_end_stage(stage, lookup.size());
+	ERR_FAIL_COND_V(err != OK, err);
+	if (job.width == 0 || job.height == 0) {
+		return OK;
+	}
+
+	HashMap<int32_t, MaterialImageCache> material_image_cache;
+	_cache_material_images(material_cache, material_image_cache, p_index);
+
+	// Every texel is independent, so the gather runs over fixed bands of rows like rasterization does.
+	stage = _begin_stage("gather", p_index);
+	Ref<Image> atlas_images[ATLAS_TEXTURE_MAX];
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		atlas_images[texture_i] = Image::create_empty(job.width, job.height, false, Image::FORMAT_RGBA8);
+		job.sampler.atlas_data[texture_i] = atlas_images[texture_i]->ptrw();
+	}
+	job.lookup = lookup.ptr();
+	job.material_image_cache = &material_image_cache;
+	const int32_t band_count = (job.height + atlas_band_height - 1) / atlas_band_height;
+	if (is_pool_thread()) {
+		for (int32_t band_i = 0; band_i < band_count; band_i++) {
+			_gather_atlas_band(band_i, &job);
+		}
+	} else {
+		WorkerThreadPool::GroupID group_task = WorkerThreadPool::get_singleton()->add_template_group_task(this, &MeshMergeMaterialRepack::_gather_atlas_band, &job, band_count, _get_thread_budget(), true, "Scene Merge Gather Atlas");
+		WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group_task);
+	}
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		atlas_images[texture_i]->generate_mipmaps();
+	}
+	_end_stage(stage, lookup.size());
+
+	Ref<ImageTexture> textures[ATLAS_TEXTURE_MAX];
+	_compress_atlas_textures(atlas_images, textures, p_index);
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		const String path = _get_output_texture_path(p_output_path, texture_i, p_index);
+		if (textures[texture_i].is_null() || !FileAccess::exists(path)) {
+			continue;
+		}
+		stage = _begin_stage("save", p_index);
+		ResourceSaver::save(textures[texture_i], path);
+		// Merged scenes that are already loaded pick up the new texels.
+		ResourceLoader::load(path, "Texture2D", ResourceFormatLoader::CACHE_MODE_REPLACE);
+		_end_stage(stage, 1);
+	}
+	return OK;
+}
+
+void MeshMergeMaterialRepack::_save_output_textures(const Ref<ArrayMesh> &p_mesh, const String &p_output_path, int p_count) {
+	Ref<BaseMaterial3D> mat = p_mesh->surface_get_material(0);
+	ERR_FAIL_COND(mat.is_null());
+	const BaseMaterial3D::TextureParam texture_params[ATLAS_TEXTURE_MAX] = {
+		BaseMaterial3D::TEXTURE_ALBEDO,
+		BaseMaterial3D::TEXTURE_EMISSION,
+		BaseMaterial3D::TEXTURE_NORMAL,
+		BaseMaterial3D::TEXTURE_AMBIENT_OCCLUSION,
+	};
+	for (int32_t texture_i = 0; texture_i < ATLAS_TEXTURE_MAX; texture_i++) {
+		const Ref<Texture2D> tex = mat->get_texture(texture_params[texture_i]);
+		if (tex.is_null()) {
+			continue;
+		}
+		const String path = _get_output_texture_path(p_output_path, texture_i, p_count);
+		const int32_t stage = _begin_stage("save", p_count);
+		if (ResourceSaver::save(tex, path) != OK) {
+			_set_merge_error(ERR_FILE_CANT_WRITE);
+			_end_stage(stage, 0);
+			ERR_FAIL_MSG("Can't save merged texture to " + path + ".");
+		}
+		// Replace any copy cached by an earlier merge into the same path.
+		Ref<Texture2D> res = ResourceLoader::load(path, "Texture2D", ResourceFormatLoader::CACHE_MODE_REPLACE);
+		_end_stage(stage, 1);
+		for (int32_t param_i = 0; param_i < BaseMaterial3D::TEXTURE_MAX; param_i++) {
+			if (mat->get_texture(BaseMaterial3D::TextureParam(param_i)) == tex) {
+				mat->set_texture(BaseMaterial3D::TextureParam(param_i), res);
+			}
+		}
+	}
+}
+
+Node *MeshMergeMaterialRepack::_apply_output(Node *p_root, const Vector<MeshState> &p_mesh_items, const Ref<ArrayMesh> &p_mesh, const String &p_name, int32_t p_hlod_level) {
+	// HLOD proxies sit alongside the merged groups, the source meshes were already replaced at level 0.
+	for (int32_t mesh_i = 0; p_hlod_level == 0 && mesh_i < p_mesh_items.size(); mesh_i++) {
+		if (p_mesh_items[mesh_i].mesh_instance->get_parent()) {
+			Node3D *node_3d = memnew(Node3D);
+			Transform3D xform = p_mesh_items[mesh_i].mesh_instance->get_transform();
+			node_3d->set_transform(xform);
+			node_3d->set_name(p_mesh_items[mesh_i].mesh_instance->get_name());
+			p_mesh_items[mesh_i].mesh_instance->replace_by(node_3d);
+		}
 	}
 	MeshInstance3D *mi = memnew(MeshInstance3D);
-	Ref<ArrayMesh> array_mesh = st_all->commit();
-	mi->set_mesh(array_mesh);
-	mi->set_name(state.p_name);
+	mi->set_mesh(p_mesh);
+	mi->set_name(p_hlod_level ? p_name + "_hlod" + itos(p_hlod_level) : p_name);
+	if (hlod_levels > 0) {
+		float range_begin = 0.0f;
+		float range_end = 0.0f;
+		_get_hlod_range(p_hlod_level, range_begin, range_end);
+		mi->set_visibility_range_begin(range_begin);
+		mi->set_visibility_range_end(range_end);
+	}
 	Transform3D root_xform;
-	Node3D *node_3d = cast_to<Node3D>(state.p_root);
+	Node3D *node_3d = cast_to<Node3D>(p_root);
 	if (node_3d) {
 		root_xform = node_3d->get_transform();
 	}
 	mi->set_transform(root_xform.affine_inverse());
-	array_mesh->surface_set_material(0, mat);
-	state.p_root->add_child(mi, true);
-	if (mi != state.p_root) {
-		mi->set_owner(state.p_root);
+	p_root->add_child(mi, true);
+	if (mi != p_root) {
+		mi->set_owner(p_root);
 	}
-	return state.p_root;
+	return p_root;
 }
 
 #ifdef TOOLS_ENABLED
@@ -1121,99 +2939,6 @@ bool MeshMergeMaterialRepack::MeshState::operator==(const MeshState &rhs) const
 	return false;
 }
 
-MeshMergeMaterialRepack::ClippedTriangle::ClippedTriangle(const Vector2 &a, const Vector2 &b, const Vector2 &c) {
-	m_area = 0;
-	m_numVertices = 3;
-	m_activeVertexBuffer = 0;
-	m_verticesA[0] = a;
-	m_verticesA[1] = b;
-	m_verticesA[2] = c;
-	m_vertexBuffers[0] = m_verticesA;
-	m_vertexBuffers[1] = m_verticesB;
-}
-
-void MeshMergeMaterialRepack::ClippedTriangle::clipHorizontalPlane(float offset, float clipdirection) {
-	Vector2 *v = m_vertexBuffers[m_activeVertexBuffer];
-	m_activeVertexBuffer ^= 1;
-	Vector2 *v2 = m_vertexBuffers[m_activeVertexBuffer];
-	v[m_numVertices] = v[0];
-	float dy2, dy1 = offset - v[0].y;
-	int dy2in, dy1in = clipdirection * dy1 >= 0;
-	uint32_t p = 0;
-	for (uint32_t k = 0; k < m_numVertices; k++) {
-		dy2 = offset - v[k + 1].y;
-		dy2in = clipdirection * dy2 >= 0;
-		if (dy1in) v2[p++] = v[k];
-		if (dy1in + dy2in == 1) { // not both in/out
-			float dx = v[k + 1].x - v[k].x;
-			float dy = v[k + 1].y - v[k].y;
-			v2[p++] = Vector2(v[k].x + dy1 * (dx / dy), offset);
-		}
-		dy1 = dy2;
-		dy1in = dy2in;
-	}
-	m_numVertices = p;
-}
-
-void MeshMergeMaterialRepack::ClippedTriangle::clipVerticalPlane(float offset, float clipdirection) {
-	Vector2 *v = m_vertexBuffers[m_activeVertexBuffer];
-	m_activeVertexBuffer ^= 1;
-	Vector2 *v2 = m_vertexBuffers[m_activeVertexBuffer];
-	v[m_numVertices] = v[0];
-	float dx2, dx1 = offset - v[0].x;
-	int dx2in, dx1in = clipdirection * dx1 >= 0;
-	uint32_t p = 0;
-	for (uint32_t k = 0; k < m_numVertices; k++) {
-		dx2 = offset - v[k + 1].x;
-		dx2in = clipdirection * dx2 >= 0;
-		if (dx1in) v2[p++] = v[k];
-		if (dx1in + dx2in == 1) { // not both in/out
-			float dx = v[k + 1].x - v[k].x;
-			float dy = v[k + 1].y - v[k].y;
-			v2[p++] = Vector2(offset, v[k].y + dx1 * (dy / dx));
-		}
-		dx1 = dx2;
-		dx1in = dx2in;
-	}
-	m_numVertices = p;
-}
-
-void MeshMergeMaterialRepack::ClippedTriangle::computeAreaCentroid() {
-	Vector2 *v = m_vertexBuffers[m_activeVertexBuffer];
-	v[m_numVertices] = v[0];
-	m_area = 0;
-	float centroidx = 0, centroidy = 0;
-	for (uint32_t k = 0; k < m_numVertices; k++) {
-		// http://local.wasp.uwa.edu.au/~pbourke/geometry/polyarea/
-		float f = v[k].x * v[k + 1].y - v[k + 1].x * v[k].y;
-		m_area += f;
-		centroidx += f * (v[k].x + v[k + 1].x);
-		centroidy += f * (v[k].y + v[k + 1].y);
-	}
-	m_area = 0.5f * fabsf(m_area);
-	if (m_area == 0) {
-		m_centroid = Vector2(0.0f, 0.0f);
-	} else {
-		m_centroid = Vector2(centroidx / (6 * m_area), centroidy / (6 * m_area));
-	}
-}
-
-void MeshMergeMaterialRepack::ClippedTriangle::clipAABox(float x0, float y0, float x1, float y1) {
-	clipVerticalPlane(x0, -1);
-	clipHorizontalPlane(y0, -1);
-	clipVerticalPlane(x1, 1);
-	clipHorizontalPlane(y1, 1);
-	computeAreaCentroid();
-}
-
-Vector2 MeshMergeMaterialRepack::ClippedTriangle::centroid() {
-	return m_centroid;
-}
-
-float MeshMergeMaterialRepack::ClippedTriangle::area() {
-	return m_area;
-}
-
 MeshMergeMaterialRepack::Triangle::Triangle(const Vector2 &v0, const Vector2 &v1, const Vector2 &v2, const Vector3 &t0, const Vector3 &t1, const Vector3 &t2) {
 	// Init vertices.
 	this->v1 = v0;
@@ -1272,10 +2997,71 @@ void MeshMergeMaterialRepack::Triangle::computeUnitInwardNormals() {
 	n3 = n3 * (1.0f / sqrtf(n3.x * n3.x + n3.y * n3.y));
 }
 
-bool MeshMergeMaterialRepack::Triangle::drawAA(SamplingCallback cb, void *param) {
+// Coverage of one 8 texel row of a rasterization block.
+struct RasterRow8 {
+	uint32_t covered_mask = 0;
+	uint32_t inside_mask = 0;
+	float bar[3][8];
+};
+
+// Evaluates the three edge functions and the barycentrics for the 8 texel centers p_x0 + [0, 8) of a row.
+// A texel is covered when the texel square overlaps the triangle (separating axis test against the
+// three edges and the triangle bounds), and inside when it is completely covered.
+static _FORCE_INLINE_ void rasterize_row8(const float p_edge[3], const float p_edge_step[3], const float p_edge_outside[3], float p_inside,
+		float p_x0, float p_x_min, float p_x_max, const float p_bar[3], const float p_bar_step[3], RasterRow8 &r_row) {
+#if defined(SCENE_MERGE_SIMD_AVX2)
+	const __m256 lane = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	const __m256 x = _mm256_add_ps(_mm256_set1_ps(p_x0), lane);
+	__m256 covered = _mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(p_x_min), _CMP_GT_OQ), _mm256_cmp_ps(x, _mm256_set1_ps(p_x_max), _CMP_LT_OQ));
+	__m256 inside = covered;
+	for (int32_t k = 0; k < 3; k++) {
+		const __m256 edge = _mm256_add_ps(_mm256_set1_ps(p_edge[k]), _mm256_mul_ps(_mm256_set1_ps(p_edge_step[k]), lane));
+		covered = _mm256_and_ps(covered, _mm256_cmp_ps(edge, _mm256_set1_ps(p_edge_outside[k]), _CMP_GT_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(edge, _mm256_set1_ps(p_inside), _CMP_GE_OQ));
+		_mm256_storeu_ps(r_row.bar[k], _mm256_add_ps(_mm256_set1_ps(p_bar[k]), _mm256_mul_ps(_mm256_set1_ps(p_bar_step[k]), lane)));
+	}
+	r_row.covered_mask = _mm256_movemask_ps(covered);
+	r_row.inside_mask = _mm256_movemask_ps(inside);
+#elif defined(SCENE_MERGE_SIMD_SSE2)
+	r_row.covered_mask = 0;
+	r_row.inside_mask = 0;
+	for (int32_t half = 0; half < 2; half++) {
+		const __m128 lane = _mm_add_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(half * 4.0f));
+		const __m128 x = _mm_add_ps(_mm_set1_ps(p_x0), lane);
+		__m128 covered = _mm_and_ps(_mm_cmpgt_ps(x, _mm_set1_ps(p_x_min)), _mm_cmplt_ps(x, _mm_set1_ps(p_x_max)));
+		__m128 inside = covered;
+		for (int32_t k = 0; k < 3; k++) {
+			const __m128 edge = _mm_add_ps(_mm_set1_ps(p_edge[k]), _mm_mul_ps(_mm_set1_ps(p_edge_step[k]), lane));
+			covered = _mm_and_ps(covered, _mm_cmpgt_ps(edge, _mm_set1_ps(p_edge_outside[k])));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, _mm_set1_ps(p_inside)));
+			_mm_storeu_ps(r_row.bar[k] + half * 4, _mm_add_ps(_mm_set1_ps(p_bar[k]), _mm_mul_ps(_mm_set1_ps(p_bar_step[k]), lane)));
+		}
+		r_row.covered_mask |= _mm_movemask_ps(covered) << (half * 4);
+		r_row.inside_mask |= _mm_movemask_ps(inside) << (half * 4);
+	}
+#else
+	r_row.covered_mask = 0;
+	r_row.inside_mask = 0;
+	for (int32_t i = 0; i < 8; i++) {
+		const float x = p_x0 + i;
+		bool covered = x > p_x_min && x < p_x_max;
+		bool inside = covered;
+		for (int32_t k = 0; k < 3; k++) {
+			const float edge = p_edge[k] + p_edge_step[k] * i;
+			covered = covered && edge > p_edge_outside[k];
+			inside = inside && edge >= p_inside;
+			r_row.bar[k][i] = p_bar[k] + p_bar_step[k] * i;
+		}
+		r_row.covered_mask |= uint32_t(covered) << i;
+		r_row.inside_mask |= uint32_t(inside) << i;
+	}
+#endif
+}
+
+template <class Sampler>
+bool MeshMergeMaterialRepack::Triangle::drawAA(Sampler &p_sampler, const Rect2i &p_clip) {
 	const float PX_INSIDE = 1.0f / sqrtf(2.0f);
-	const float PX_OUTSIDE = -1.0f / sqrtf(2.0f);
-	const float BK_SIZE = 8;
+	const float BK_SIZE = 8; // Matches the width of rasterize_row8.
 	const float BK_INSIDE = sqrtf(BK_SIZE * BK_SIZE / 2.0f);
 	const float BK_OUTSIDE = -sqrtf(BK_SIZE * BK_SIZE / 2.0f);
 	float minx, miny, maxx, maxy;
@@ -1297,9 +3083,32 @@ bool MeshMergeMaterialRepack::Triangle::drawAA(SamplingCallback cb, void *param)
 	float C1 = n1.x * (-v1.x) + n1.y * (-v1.y);
 	float C2 = n2.x * (-v2.x) + n2.y * (-v2.y);
 	float C3 = n3.x * (-v3.x) + n3.y * (-v3.y);
+	const float clip_x0 = p_clip.position.x;
+	const float clip_y0 = p_clip.position.y;
+	const float clip_x1 = p_clip.get_end().x;
+	const float clip_y1 = p_clip.get_end().y;
+	// A texel square is outside an edge when its farthest corner is, which is half its extent along the edge normal.
+	const float edge_step[3] = { n1.x, n2.x, n3.x };
+	const float edge_outside[3] = {
+		-0.5f * (fabsf(n1.x) + fabsf(n1.y)),
+		-0.5f * (fabsf(n2.x) + fabsf(n2.y)),
+		-0.5f * (fabsf(n3.x) + fabsf(n3.y)),
+	};
+	const float bar_step[3] = { dx.x, dx.y, dx.z };
+	// Texel centers strictly inside these bounds overlap the triangle bounds and the scissor rectangle.
+	const float column_min = MAX(clip_x0, MIN(v1.x, MIN(v2.x, v3.x))) - 0.5f;
+	const float column_max = MIN(clip_x1, MAX(v1.x, MAX(v2.x, v3.x)) + 0.5f);
+	const float row_min = MAX(clip_y0, MIN(v1.y, MIN(v2.y, v3.y))) - 0.5f;
+	const float row_max = MIN(clip_y1, MAX(v1.y, MAX(v2.y, v3.y)) + 0.5f);
 	// Loop through blocks
 	for (float y0 = miny; y0 <= maxy; y0 += BK_SIZE) {
+		if (y0 + BK_SIZE <= clip_y0 || y0 >= clip_y1) {
+			continue;
+		}
 		for (float x0 = minx; x0 <= maxx; x0 += BK_SIZE) {
+			if (x0 + BK_SIZE <= clip_x0 || x0 >= clip_x1) {
+				continue;
+			}
 			// Corners of block
 			float xc = (x0 + (BK_SIZE - 1) / 2.0f);
 			float yc = (y0 + (BK_SIZE - 1) / 2.0f);
@@ -1313,52 +3122,45 @@ bool MeshMergeMaterialRepack::Triangle::drawAA(SamplingCallback cb, void *param)
 			if ((aC >= BK_INSIDE) && (bC >= BK_INSIDE) && (cC >= BK_INSIDE)) {
 				Vector3 texRow = t1 + dy * (y0 - v1.y) + dx * (x0 - v1.x);
 				for (float y = y0; y < y0 + BK_SIZE; y++) {
-					Vector3 tex = texRow;
-					for (float x = x0; x < x0 + BK_SIZE; x++) {
-						if (!cb(param, (int)x, (int)y, tex, dx, dy, 1.0f)) {
-							return false;
+					if (y >= clip_y0 && y < clip_y1) {
+						Vector3 tex = texRow;
+						for (float x = x0; x < x0 + BK_SIZE; x++) {
+							if (x >= clip_x0 && x < clip_x1) {
+								if (!p_sampler((int)x, (int)y, tex, dx, dy, 1.0f)) {
+									return false;
+								}
+							}
+							tex += dx;
 						}
-						tex += dx;
 					}
 					texRow += dy;
 				}
 			} else { // Partially covered block
-				float CY1 = C1 + n1.x * x0 + n1.y * y0;
-				float CY2 = C2 + n2.x * x0 + n2.y * y0;
-				float CY3 = C3 + n3.x * x0 + n3.y * y0;
-				Vector3 texRow = t1 + dy * (y0 - v1.y) + dx * (x0 - v1.x);
-				for (float y = y0; y < y0 + BK_SIZE; y++) { // @@ This is not clipping to scissor rectangle correctly.
-					float CX1 = CY1;
-					float CX2 = CY2;
-					float CX3 = CY3;
-					Vector3 tex = texRow;
-					for (float x = x0; x < x0 + BK_SIZE; x++) { // @@ This is not clipping to scissor rectangle correctly.
-						Vector3 tex2 = t1 + dx * (x - v1.x) + dy * (y - v1.y);
-						if (CX1 >= PX_INSIDE && CX2 >= PX_INSIDE && CX3 >= PX_INSIDE) {
-							// pixel completely covered
-							if (!cb(param, (int)x, (int)y, tex2, dx, dy, 1.0f)) {
-								return false;
-							}
-						} else if ((CX1 >= PX_OUTSIDE) && (CX2 >= PX_OUTSIDE) && (CX3 >= PX_OUTSIDE)) {
-							// triangle partially covers pixel. do clipping.
-							ClippedTriangle ct(v1 - Vector2(x, y), v2 - Vector2(x, y), v3 - Vector2(x, y));
-							ct.clipAABox(-0.5, -0.5, 0.5, 0.5);
-							float area = ct.area();
-							if (area > 0.0f) {
-								if (!cb(param, (int)x, (int)y, tex2, dx, dy, 0.0f)) {
-									return false;
-								}
-							}
+				for (float y = y0; y < y0 + BK_SIZE; y++) {
+					if (y <= row_min || y >= row_max) {
+						continue;
+					}
+					const float edge[3] = {
+						C1 + n1.x * x0 + n1.y * y,
+						C2 + n2.x * x0 + n2.y * y,
+						C3 + n3.x * x0 + n3.y * y,
+					};
+					const Vector3 texRow = t1 + dx * (x0 - v1.x) + dy * (y - v1.y);
+					const float bar[3] = { texRow.x, texRow.y, texRow.z };
+					RasterRow8 row;
+					rasterize_row8(edge, edge_step, edge_outside, PX_INSIDE, x0, column_min, column_max, bar, bar_step, row);
+					uint32_t mask = row.covered_mask;
+					for (int32_t lane = 0; mask; lane++, mask >>= 1) {
+						if (!(mask & 1)) {
+							continue;
+						}
+						// Texels that are only partially covered report zero coverage.
+						const float coverage = (row.inside_mask >> lane) & 1 ? 1.0f : 0.0f;
+						const Vector3 tex(row.bar[0][lane], row.bar[1][lane], row.bar[2][lane]);
+						if (!p_sampler((int)(x0 + lane), (int)y, tex, dx, dy, coverage)) {
+							return false;
 						}
-						CX1 += n1.x;
-						CX2 += n2.x;
-						CX3 += n3.x;
-						tex += dx;
 					}
-					CY1 += n1.y;
-					CY2 += n2.y;
-					CY3 += n3.y;
-					texRow += dy;
 				}
 			}
 		}
@@ -97,12 +97,36 @@ public:
 
 #include "core/math/vector2.h"
 #include "core/object/ref_counted.h"
+#include "core/os/mutex.h"
+#include "core/templates/local_vector.h"
 #include "scene/3d/mesh_instance_3d.h"
 
 #include "thirdparty/xatlas/xatlas.h"
 
 class MeshMergeMaterialRepack : public RefCounted {
+	GDCLASS(MeshMergeMaterialRepack, RefCounted);
+
+public:
+	enum PackMode {
+		PACK_MODE_FAST,
+		PACK_MODE_BRUTE_FORCE, // Tries every chart position. Denser atlases, much slower packing.
+		PACK_MODE_AUTO, // Brute force when there are more processors than merge groups packing at once.
+	};
+	enum MergeMode {
+		MERGE_MODE_ATLAS, // Repack every material into one texture atlas and a single surface.
+		MERGE_MODE_BATCH_BY_MATERIAL, // Keep the source materials and append geometry into one surface per material.
+	};
+
 private:
+
+	enum AtlasTextureType {
+		ATLAS_TEXTURE_ALBEDO,
+		ATLAS_TEXTURE_EMISSION,
+		ATLAS_TEXTURE_NORMAL,
+		ATLAS_TEXTURE_ORM,
+		ATLAS_TEXTURE_MAX,
+	};
+
 	struct TextureData {
 		uint16_t width;
 		uint16_t height;
@@ -110,9 +134,6 @@ private:
 		Ref<Image> image;
 	};
 
-	/// A callback to sample the environment. Return false to terminate rasterization.
-	typedef bool (*SamplingCallback)(void *param, int x, int y, const Vector3 &bar, const Vector3 &dx, const Vector3 &dy, float coverage);
-
 	struct Triangle {
 		Triangle(const Vector2 &v0, const Vector2 &v1, const Vector2 &v2, const Vector3 &t0, const Vector3 &t1, const Vector3 &t2);
 
@@ -127,7 +148,11 @@ private:
 		// compute unit inward normals for each edge.
 		void computeUnitInwardNormals();
 
-		bool drawAA(SamplingCallback cb, void *param);
+		/// Only texels inside p_clip are sampled, which lets disjoint regions of the atlas be rasterized concurrently.
+		/// The sampler is called as sampler(x, y, bar, dx, dy, coverage) and is inlined into the rasterization loop.
+		/// It returns false to terminate rasterization.
+		template <class Sampler>
+		bool drawAA(Sampler &p_sampler, const Rect2i &p_clip);
 
 		Vector2 v1, v2, v3;
 		Vector2 n1, n2, n3; // unit inward normals
@@ -135,64 +160,113 @@ private:
 		Vector3 dx, dy;
 	};
 
-	class ClippedTriangle {
-	public:
-		ClippedTriangle(const Vector2 &a, const Vector2 &b, const Vector2 &c);
-		void clipHorizontalPlane(float offset, float clipdirection);
-		void clipVerticalPlane(float offset, float clipdirection);
-		void computeAreaCentroid();
-		void clipAABox(float x0, float y0, float x1, float y1);
-		Vector2 centroid();
-		float area();
+	// Where one atlas texel was sampled from: the material and its source UV, wrapped into 0-1 and stored as 16-bit
+	// fixed point so each layer can be gathered again at whatever resolution its source texture has.
+	// Material index 0 is the empty material and marks texels that no chart covers.
+	struct AtlasLookupTexel {
+		uint16_t material_index = 0;
+		uint16_t u = 0;
+		uint16_t v = 0;
+	};
 
-	private:
-		Vector2 m_verticesA[7 + 1];
-		Vector2 m_verticesB[7 + 1];
-		Vector2 *m_vertexBuffers[2];
-		uint32_t m_numVertices;
-		uint32_t m_activeVertexBuffer;
-		float m_area;
-		Vector2 m_centroid;
+	enum OrmChannel {
+		ORM_CHANNEL_OCCLUSION,
+		ORM_CHANNEL_ROUGHNESS,
+		ORM_CHANNEL_METALLIC,
+		ORM_CHANNEL_MAX,
 	};
 
-	struct AtlasLookupTexel {
-		uint16_t material_index;
-		uint16_t x, y;
+	// One channel of the packed ORM layer, read from its own source map at that map's resolution.
+	struct OrmChannelSource {
+		Ref<Image> image;
+		uint8_t channel = 0; // Byte of the RGBA8 source texel.
+		float multiplier = 1.0f;
+		uint8_t value = 0; // Used when there is no source map.
 	};
 
-	struct SetAtlasTexelArgs {
-		Ref<Image> atlasData;
-		Ref<Image> sourceTexture;
+	struct MaterialImageCache;
+	// Every atlas layer shares the same chart coverage, so one rasterization pass writes all of them.
+	// Source and atlas layers are RGBA8 and are read and written directly through their pixel buffers.
+	// Each source is sampled at its own resolution with the mesh's normalized UVs.
+	struct AtlasTexelSampler {
+		uint8_t *atlas_data[ATLAS_TEXTURE_MAX] = {};
+		const uint8_t *source_data[ATLAS_TEXTURE_MAX] = {};
+		int32_t source_width[ATLAS_TEXTURE_MAX] = {};
+		int32_t source_height[ATLAS_TEXTURE_MAX] = {};
+		bool has_orm = false;
+		const uint8_t *orm_data[ORM_CHANNEL_MAX] = {};
+		int32_t orm_width[ORM_CHANNEL_MAX] = {};
+		int32_t orm_height[ORM_CHANNEL_MAX] = {};
+		uint8_t orm_channel[ORM_CHANNEL_MAX] = {};
+		float orm_multiplier[ORM_CHANNEL_MAX] = {};
+		uint8_t orm_value[ORM_CHANNEL_MAX] = {};
 		AtlasLookupTexel *atlas_lookup = nullptr;
 		uint16_t material_index = 0;
 		Vector2 source_uvs[3];
 		uint32_t atlas_width = 0;
+
+		void set_material(const MaterialImageCache *p_cache);
+		_FORCE_INLINE_ void write_texel(uint32_t p_atlas_offset, const Vector2 &p_source_uv);
+		_FORCE_INLINE_ bool operator()(int x, int y, const Vector3 &bar, const Vector3 &, const Vector3 &, float);
 	};
 
-	const int32_t default_texture_length = 512;
+	// Rows of the atlas rasterized by one WorkerThreadPool task. Fixed so the output does not depend on the core count.
+	const int32_t atlas_band_height = 32;
 
 	struct ModelVertex {
 		Vector3 pos;
 		Vector3 normal;
 		Vector2 uv;
+		Vector2 uv2; // Source lightmap UV moved into the group's packed layout, when the group keeps source UV2.
+	};
+	// Typed copy of one source surface, taken once while scanning the scene and read by every later stage.
+	struct SurfaceSnapshot {
+		LocalVector<Vector3> positions;
+		LocalVector<Vector3> normals;
+		LocalVector<Vector2> uvs;
+		LocalVector<Vector2> uv2s; // Empty when the source surface has no lightmap UVs.
+		LocalVector<uint32_t> indices;
+		int32_t material_id = 0; // Index into the merge group's material cache; every face of the surface shares it.
 	};
 	struct MeshState {
 		Ref<Mesh> mesh;
 		NodePath path;
 		MeshInstance3D *mesh_instance;
+		int32_t surface_id = -1;
 		bool operator==(const MeshState &rhs) const;
 	};
 	struct MaterialImageCache {
-		Ref<Image> albedo_img;
-		Ref<Image> normal_img;
-		Ref<Image> orm_img;
-		Ref<Image> emission_img;
+		Ref<Image> images[ATLAS_TEXTURE_MAX];
+		// The ORM layer is packed while rasterizing, so its maps never need to be resampled to a common size.
+		bool has_orm = false;
+		OrmChannelSource orm[ORM_CHANNEL_MAX];
+	};
+	// Every source texture of a material, fetched, decompressed and converted to RGBA8 once at its native resolution.
+	struct MaterialSourceImages {
+		Ref<Image> images[BaseMaterial3D::TEXTURE_MAX];
+	};
+	// The part of an xatlas result read by rasterization and output, built from xatlas or loaded from a sidecar file.
+	struct AtlasChartData {
+		uint32_t material = 0;
+		uint32_t first_face = 0; // Into AtlasMeshData::chart_faces.
+		uint32_t face_count = 0;
+	};
+	struct AtlasMeshData {
+		LocalVector<Vector2> uvs; // In atlas texels.
+		LocalVector<uint32_t> xrefs; // Source vertex of each atlas vertex.
+		LocalVector<uint32_t> indices;
+		LocalVector<AtlasChartData> charts;
+		LocalVector<uint32_t> chart_faces;
+	};
+	struct AtlasResult {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		LocalVector<AtlasMeshData> meshes;
 	};
 	struct MergeState {
 		Node *p_root;
-		xatlas::Atlas *atlas;
+		const AtlasResult *atlas;
 		Vector<MeshState> &r_mesh_items;
-		Array &vertex_to_material;
 		const Vector<Vector<Vector2> > uvs;
 		const Vector<Vector<ModelVertex> > &model_vertices;
 		String p_name;
@@ -200,32 +274,176 @@ private:
 		const xatlas::PackOptions &pack_options;
 		Vector<AtlasLookupTexel> &atlas_lookup;
 		Vector<Ref<Material> > &material_cache;
-		HashMap<String, Ref<Image> > texture_atlas;
 		HashMap<int32_t, MaterialImageCache> material_image_cache;
+		Ref<Image> texture_atlas[ATLAS_TEXTURE_MAX];
+		int32_t group = -1;
+		bool has_uv2 = false;
 	};
 	struct MeshMerge {
 		Vector<MeshState> meshes;
 		int vertex_count = 0;
 	};
-	static bool setAtlasTexel(void *param, int x, int y, const Vector3 &bar, const Vector3 &, const Vector3 &, float);
+	// One eligible surface while merge groups are being clustered.
+	struct ClusterItem {
+		MeshState item;
+		MeshState original_item;
+		AABB bounds;
+		uint32_t vertex_count = 0;
+		uint32_t triangle_count = 0;
+		uint32_t order = 0; // Scan order, used to break ties so clustering is deterministic.
+	};
+	struct ClusterBudget {
+		int32_t max_vertices = 0; // 0 for no limit, like the other budgets.
+		int32_t max_triangles = 0;
+		float max_extent = 0.0f;
+	};
+	struct ClusterAxisComparator {
+		int32_t axis = 0;
+		_FORCE_INLINE_ bool operator()(const ClusterItem &p_a, const ClusterItem &p_b) const {
+			const real_t a = p_a.bounds.get_center()[axis];
+			const real_t b = p_b.bounds.get_center()[axis];
+			return a < b || (a == b && p_a.order < p_b.order);
+		}
+	};
+	struct ClusterOrderComparator {
+		_FORCE_INLINE_ bool operator()(const ClusterItem &p_a, const ClusterItem &p_b) const {
+			return p_a.order < p_b.order;
+		}
+	};
+	struct AtlasChartBounds {
+		uint32_t mesh_index = 0;
+		uint32_t chart_index = 0;
+		float min_y = 0.0f;
+		float max_y = 0.0f;
+	};
+	struct RasterizeAtlasJob {
+		const MergeState *state = nullptr;
+		Ref<Image> atlas_images[ATLAS_TEXTURE_MAX];
+		AtlasTexelSampler sampler;
+		LocalVector<AtlasChartBounds> charts;
+	};
+	struct GatherAtlasJob {
+		const AtlasLookupTexel *lookup = nullptr;
+		const HashMap<int32_t, MaterialImageCache> *material_image_cache = nullptr;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		AtlasTexelSampler sampler;
+	};
+	// Wall time, Godot allocator usage and processed item count of one stage of the last merge.
+	struct MergeStage {
+		String name;
+		int32_t group = -1; // Merge group, or -1 for stages that cover the whole scene.
+		uint64_t start_usec = 0;
+		uint64_t end_usec = 0;
+		uint64_t items = 0;
+		uint64_t memory_start = 0;
+		uint64_t memory_max_start = 0;
+		int64_t memory_delta = 0;
+		uint64_t memory_peak = 0; // How far the allocator high-water mark rose above memory_start, 0 if it did not move.
+	};
+	LocalVector<MergeStage> merge_stages;
+	Mutex merge_stages_mutex;
+	uint64_t merge_start_usec = 0;
+	uint64_t merge_end_usec = 0;
+	Error merge_error = OK; // First failure of the last merge, reported by get_merge_error() and get_merge_stats().
+	String trace_path;
+	bool cache_enabled = true;
+	String cache_dir; // Empty keeps the cache in .scene_merge_cache next to the output scene.
+	int32_t cluster_max_vertices = 65536;
+	int32_t cluster_max_triangles = 0; // 0 for no limit.
+	float cluster_max_extent = 0.0f; // Longest side of a group's bounds, 0 for no limit.
+	int32_t hlod_levels = 0; // Proxy levels built above the merged groups, 0 to only merge.
+	float hlod_distance = 50.0f; // Where the first proxy level replaces the merged groups. Each level doubles it.
+	float hlod_cell_size = 64.0f; // Extent of first level proxy cells. Each level doubles it.
+	float hlod_reduction = 0.25f; // Share of the triangles each proxy level keeps from the level below.
+	float hlod_max_error = 0.02f; // How far a proxy may drift from the meshes it replaces, relative to its cell size.
+	bool optimize_vertex_order = true; // Vertex cache, overdraw and vertex fetch order of merged surfaces.
+	bool weld_vertices = false;
+	int32_t lod_count = 0; // Simplified index buffers generated per merged surface.
+	float lod_reduction = 0.5f; // Index count of each LOD relative to the one before it.
+	float lod_max_error = 0.05f; // Relative to the surface extents.
+	int32_t thread_budget = 0; // Pool threads one merge may occupy at once, 0 for the whole WorkerThreadPool.
+	PackMode pack_mode = PACK_MODE_FAST;
+	MergeMode merge_mode = MERGE_MODE_ATLAS;
+	bool generate_uv2 = false; // Lightmap UV2 for the merged mesh. Cached meshes keep theirs, since the flag is part of the cache key.
+	int32_t _get_thread_budget() const;
+	int32_t _begin_stage(const String &p_name, int32_t p_group = -1);
+	void _end_stage(int32_t p_stage, uint64_t p_items);
+	void _set_merge_error(Error p_error);
+	Error _write_trace(const String &p_path);
+	void _rasterize_atlas_band(uint32_t p_band, RasterizeAtlasJob *p_job);
+	void _gather_atlas_band(uint32_t p_band, GatherAtlasJob *p_job);
 	Ref<Image> dilate(Ref<Image> source_image);
 	void _find_all_animated_meshes(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner);
-	void _find_all_mesh_instances(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner);
-	void _generate_texture_atlas(MergeState &state, String texture_type);
-	Ref<Image> _get_source_texture(MergeState &state, Ref<BaseMaterial3D> material, String texture_type);
-	void _generate_atlas(const int32_t p_num_meshes, Vector<Vector<Vector2> > &r_uvs, xatlas::Atlas *atlas, const Vector<MeshState> &r_meshes, const Vector<Ref<Material> > material_cache,
-			xatlas::PackOptions &pack_options);
-	void scale_uvs_by_texture_dimension(const Vector<MeshState> &original_mesh_items, Vector<MeshState> &mesh_items, Vector<Vector<Vector2> > &uv_groups, Array &r_vertex_to_material, Vector<Vector<ModelVertex> > &r_model_vertices);
-	void map_mesh_to_index_to_material(const Vector<MeshState> mesh_items, Array &vertex_to_material, Vector<Ref<Material> > &material_cache);
-	Node *_output(MergeState &state, int p_count);
+	void _find_all_mesh_instances(Vector<MeshMerge> &r_items, Node *p_current_node, const Node *p_owner, LocalVector<SurfaceSnapshot> *r_surfaces);
+	void _cluster_mesh_items(Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items, const LocalVector<SurfaceSnapshot> &p_surfaces, const ClusterBudget &p_budget);
+	void _split_cluster(LocalVector<ClusterItem> &r_cluster, uint32_t p_begin, uint32_t p_end, const ClusterBudget &p_budget, Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items);
+	void _add_hlod_groups(Vector<MeshMerge> &r_items, Vector<MeshMerge> *r_original_items, const LocalVector<SurfaceSnapshot> &p_surfaces, LocalVector<int32_t> &r_levels);
+	void _get_hlod_range(int32_t p_level, float &r_begin, float &r_end) const;
+	Ref<ArrayMesh> _simplify_hlod_proxy(const Ref<ArrayMesh> &p_mesh, int32_t p_level, int p_count);
+	void _snapshot_surface(const Array &p_arrays, SurfaceSnapshot &r_surface);
+	void _generate_texture_atlas(MergeState &state);
+	void _cache_material_images(const Vector<Ref<Material> > &p_material_cache, HashMap<int32_t, MaterialImageCache> &r_material_image_cache, int32_t p_group);
+	MaterialSourceImages _decode_source_images(Ref<BaseMaterial3D> material);
+	Ref<Image> _get_source_texture(const MaterialSourceImages &p_source_images, Ref<BaseMaterial3D> material, AtlasTextureType texture_type);
+	void _get_orm_sources(const MaterialSourceImages &p_source_images, Ref<BaseMaterial3D> material, MaterialImageCache &r_cache);
+	void _generate_atlas(const Vector<Vector<Vector2> > &p_uvs, const Vector<MeshState> &p_meshes, const LocalVector<SurfaceSnapshot> &p_surfaces,
+			const xatlas::PackOptions &p_pack_options, int32_t p_group, AtlasResult &r_atlas);
+	String _hash_atlas_input(const Vector<Vector<Vector2> > &p_uvs, const Vector<MeshState> &p_meshes, const LocalVector<SurfaceSnapshot> &p_surfaces, const xatlas::PackOptions &p_pack_options);
+	Error _save_atlas(const String &p_path, const AtlasResult &p_atlas);
+	Error _load_atlas(const String &p_path, const Vector<Vector<Vector2> > &p_uvs, AtlasResult &r_atlas);
+	bool _pack_source_uv2(const Vector<MeshState> &p_mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, Vector<Vector<ModelVertex> > &r_model_vertices);
+	void _transform_surfaces(const Vector<MeshState> &original_mesh_items, const Vector<MeshState> &mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, Vector<Vector<ModelVertex> > &r_model_vertices);
+	void scale_uvs_by_texture_dimension(const Vector<MeshState> &original_mesh_items, Vector<MeshState> &mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces, const Vector<Ref<Material> > &p_material_cache, Vector<Vector<Vector2> > &uv_groups, Vector<Vector<ModelVertex> > &r_model_vertices);
+	void map_mesh_to_material(const Vector<MeshState> &mesh_items, LocalVector<SurfaceSnapshot> &r_surfaces, Vector<Ref<Material> > &material_cache);
+	Ref<ArrayMesh> _build_output(MergeState &state, int p_count);
+	void _optimize_surface_arrays(Array &r_arrays, int p_count);
+	Dictionary _generate_lods(const Array &p_arrays, int p_count);
+	void _add_merged_surface(const Ref<ArrayMesh> &p_mesh, Array &r_arrays, const Ref<Material> &p_material, int p_count);
+	void _compress_atlas_textures(const Ref<Image> p_atlas[ATLAS_TEXTURE_MAX], Ref<ImageTexture> r_textures[ATLAS_TEXTURE_MAX], int p_count);
+	void _save_output_textures(const Ref<ArrayMesh> &p_mesh, const String &p_output_path, int p_count);
+	String _get_output_texture_path(const String &p_output_path, int32_t p_texture, int p_count) const;
+	String _get_lookup_path(const String &p_output_path, int p_count) const;
+	Error _save_lookup(const String &p_path, uint32_t p_width, uint32_t p_height, uint32_t p_material_count, const Vector<AtlasLookupTexel> &p_lookup);
+	Error _load_lookup(const String &p_path, uint32_t p_material_count, uint32_t &r_width, uint32_t &r_height, Vector<AtlasLookupTexel> &r_lookup);
+	Error _rebake_group(const Vector<MeshState> &p_mesh_items, LocalVector<SurfaceSnapshot> &p_surfaces, const String &p_output_path, int p_index);
+	Node *_apply_output(Node *p_root, const Vector<MeshState> &p_mesh_items, const Ref<ArrayMesh> &p_mesh, const String &p_name, int32_t p_hlod_level = 0);
+	String _hash_merge_group(int32_t p_hlod_level, const Vector<MeshState> &p_mesh_items, const Vector<MeshState> &p_original_mesh_items, const LocalVector<SurfaceSnapshot> &p_surfaces,
+			const Vector<Ref<Material> > &p_material_cache, const xatlas::PackOptions &p_pack_options);
+	String _get_cache_path(const String &p_output_path, const String &p_hash, const String &p_extension) const;
+	String _get_cache_temp_path(const String &p_path) const;
+	Error _commit_cache_file(const String &p_temp_path, Error p_error, const String &p_path);
+	// One merge group, prepared on the thread that called merge, built on a pool thread and applied on the calling
+	// thread again.
+	struct MergeGroupJob {
+		Vector<MeshState> mesh_items;
+		Vector<Ref<Material> > material_cache;
+		xatlas::PackOptions pack_options;
+		Vector<Vector<Vector2> > uv_groups;
+		Vector<Vector<ModelVertex> > model_vertices;
+		HashMap<int32_t, MaterialImageCache> material_image_cache;
+		String name;
+		int32_t hlod_level = 0;
+		bool has_source_uv2 = false; // Model vertices carry packed source UV2, so the merged mesh needs no unwrap.
+		String cache_path;
+		bool cache_hit = false;
+		Ref<ArrayMesh> merged_mesh;
+	};
 	struct MeshMergeState {
 		Vector<MeshMerge> mesh_items;
 		Vector<MeshMerge> original_mesh_items;
+		LocalVector<SurfaceSnapshot> surfaces;
+		LocalVector<MergeGroupJob> groups;
 		Node *root = nullptr;
 		Node *original_root = nullptr;
 		String output_path;
 	};
-	Node *_merge_list(MeshMergeState p_mesh_merge_state, int p_index);
+	void _prepare_merge_group(MeshMergeState &p_mesh_merge_state, int p_index);
+	void _build_merge_group(uint32_t p_index, MeshMergeState *p_mesh_merge_state);
+	Ref<ArrayMesh> _build_atlas_group(MergeGroupJob &p_job, const MeshMergeState &p_mesh_merge_state, int p_index);
+	Ref<ArrayMesh> _build_material_batches(const MergeGroupJob &p_job, const LocalVector<SurfaceSnapshot> &p_surfaces, int p_index);
+	bool _bind_batch_materials(MergeGroupJob &p_job, const LocalVector<SurfaceSnapshot> &p_surfaces);
+	Node *_apply_merge_group(MeshMergeState &p_mesh_merge_state, int p_index);
 	void _mark_nodes(Node *p_current, Node *p_owner, Vector<Node *> &r_nodes);
 	void _remove_empty_Node3Ds(Node *scene);
 	void _clean_animation_player(Node *scene);
@@ -236,4 +454,50 @@ protected:
 
 public:
 	Node *merge(Node *p_root, Node *p_original_root, String p_output_path);
-};
\ No newline at end of file
+	Error rebake(Node *p_root, const String &p_output_path);
+	Dictionary get_merge_stats();
+	Error get_merge_error() const;
+	void set_trace_path(const String &p_path);
+	String get_trace_path() const;
+	void set_cache_enabled(bool p_enabled);
+	bool is_cache_enabled() const;
+	void set_cache_dir(const String &p_dir);
+	String get_cache_dir() const;
+	void set_cluster_max_vertices(int32_t p_count);
+	int32_t get_cluster_max_vertices() const;
+	void set_cluster_max_triangles(int32_t p_count);
+	int32_t get_cluster_max_triangles() const;
+	void set_cluster_max_extent(float p_extent);
+	float get_cluster_max_extent() const;
+	void set_hlod_levels(int32_t p_levels);
+	int32_t get_hlod_levels() const;
+	void set_hlod_distance(float p_distance);
+	float get_hlod_distance() const;
+	void set_hlod_cell_size(float p_size);
+	float get_hlod_cell_size() const;
+	void set_hlod_reduction(float p_reduction);
+	float get_hlod_reduction() const;
+	void set_hlod_max_error(float p_error);
+	float get_hlod_max_error() const;
+	void set_optimize_vertex_order(bool p_enabled);
+	bool is_optimizing_vertex_order() const;
+	void set_weld_vertices(bool p_enabled);
+	bool is_welding_vertices() const;
+	void set_lod_count(int32_t p_count);
+	int32_t get_lod_count() const;
+	void set_lod_reduction(float p_reduction);
+	float get_lod_reduction() const;
+	void set_lod_max_error(float p_error);
+	float get_lod_max_error() const;
+	void set_thread_budget(int32_t p_budget);
+	int32_t get_thread_budget() const;
+	void set_pack_mode(PackMode p_mode);
+	PackMode get_pack_mode() const;
+	void set_generate_uv2(bool p_enabled);
+	bool is_generating_uv2() const;
+	void set_merge_mode(MergeMode p_mode);
+	MergeMode get_merge_mode() const;
+};
+
+VARIANT_ENUM_CAST(MeshMergeMaterialRepack::PackMode);
+VARIANT_ENUM_CAST(MeshMergeMaterialRepack::MergeMode);
\ No newline at end of file
@@ -31,9 +31,27 @@
 #include "register_types.h"
 
 #include "core/object/class_db.h"
+#include "core/string/print_string.h"
 
+#include "batch.h"
+#include "benchmark.h"
 #include "merge.h"
 
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef TOOLS_ENABLED
+static int _print_xatlas(const char *p_format, ...) {
+	char buffer[1024];
+	va_list args;
+	va_start(args, p_format);
+	const int length = vsnprintf(buffer, sizeof(buffer), p_format, args);
+	va_end(args);
+	print_verbose(String::utf8(buffer).strip_edges(false, true));
+	return length;
+}
+#endif
+
 void initialize_scene_merge_module(ModuleInitializationLevel p_level) {
 
 #ifdef TOOLS_ENABLED
@@ -42,7 +60,12 @@ void initialize_scene_merge_module(ModuleInitializationLevel p_level) {
 		ClassDB::set_current_api(ClassDB::API_EDITOR);
 
  		ClassDB::register_class<SceneMerge>();
+		ClassDB::register_class<MeshMergeMaterialRepack>();
+		ClassDB::register_class<SceneMergeBenchmark>();
+		ClassDB::register_class<SceneMergeBatch>();
 		EditorPlugins::add_by_type<SceneMergePlugin>();
+		// xatlas keeps one process-wide print callback. It is set once here, not from the group tasks that run xatlas.
+		xatlas::SetPrint(_print_xatlas, true);
 
 		ClassDB::set_current_api(prev_api);
 	}